@@ -0,0 +1,381 @@
+//===- 231Andersen.h - Andersen points-to for CSE 231 projects --*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file provides a flow-insensitive, inclusion-based (Andersen) points-to
+// analysis of a whole module.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_231ANDERSEN_H
+#define LLVM_TRANSFORMS_231ANDERSEN_H
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SparseBitVector.h"
+#include "llvm/IR/InstVisitor.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include <deque>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+
+/*
+ * Points-to sets of a module, one for all program points.
+ *
+ * The objects are the allocas and the global variables. Every pointer value
+ * (instruction, argument or global address) is a node, and so is the content
+ * of every object. The rules are those of the may-point-to analysis:
+ *
+ *   alloca a            pts(a) ∋ a
+ *   bitcast, GEP        pts(x) ⊇ pts(operand)
+ *   select, phi         pts(x) ⊇ pts(each operand)
+ *   x = load p          pts(x) ⊇ pts(*o) for o in pts(p)
+ *   store v, p          pts(*o) ⊇ pts(v) for o in pts(p)
+ *
+ * plus, for a module, globals initialized with the address of a global, and
+ * the arguments and return values of direct calls to defined functions.
+ * Aggregate initializers, integer casts and indirect calls are not modelled.
+ *
+ * The inclusions are edges of a constraint graph solved by a worklist. Each
+ * node only propagates the part of its set it has not propagated before
+ * (difference propagation), and cycles, whose nodes end with the same set,
+ * are collapsed into one node when an edge is seen to carry a set its
+ * target already has (lazy cycle detection).
+ */
+class AndersenAnalysis: public InstVisitor<AndersenAnalysis> {
+public:
+  using PointsTo = SparseBitVector<>;
+
+  explicit AndersenAnalysis(Module & M) {
+    for (auto &G: M.globals()) {
+      if (!G.hasInitializer())
+        continue;
+      if (auto *target = dyn_cast<GlobalVariable>(strip(G.getInitializer()))) {
+        unsigned o = object(target);
+        Nodes[content(object(&G))].Pts.set(o);
+      }
+    }
+    for (auto &F: M) {
+      for (auto &BB: F)
+        for (auto &I: BB)
+          visit(I);
+    }
+    solve();
+  }
+
+  // The ids of the objects V may point to
+  const PointsTo & getPointsTo(Value * V) const {
+    auto it = ValueToNode.find(strip(V));
+    if (it == ValueToNode.end())
+      return Empty;
+    return Nodes[find(it->second)].Pts;
+  }
+
+  // The ids of the objects the content of Object (an alloca or a global) may point to
+  const PointsTo & getContentPointsTo(Value * Object) const {
+    auto it = ObjectIds.find(Object);
+    if (it == ObjectIds.end())
+      return Empty;
+    return Nodes[find(ObjectToContent[it->second])].Pts;
+  }
+
+  Value * getObject(unsigned o) const { return Objects[o]; }
+  unsigned getNumObjects() const { return Objects.size(); }
+
+  // The number of nodes merged into others because they were on a cycle
+  unsigned getNumCollapsed() const { return NumCollapsed; }
+
+  void visitAllocaInst(AllocaInst &I) {
+    unsigned o = object(&I);
+    Nodes[node(&I)].Pts.set(o);
+  }
+  void visitBitCastInst(BitCastInst &I) {
+    copy(I.getOperand(0), &I);
+  }
+  void visitGetElementPtrInst(GetElementPtrInst &I) {
+    copy(I.getPointerOperand(), &I);
+  }
+  void visitLoadInst(LoadInst &I) {
+    unsigned p = node(I.getPointerOperand());
+    unsigned x = node(&I);
+    if (p != None)
+      Nodes[p].Loads.push_back(x);
+  }
+  void visitStoreInst(StoreInst &I) {
+    unsigned p = node(I.getPointerOperand());
+    unsigned v = node(I.getValueOperand());
+    if (p != None && v != None)
+      Nodes[p].Stores.push_back(v);
+  }
+  void visitSelectInst(SelectInst &I) {
+    copy(I.getTrueValue(), &I);
+    copy(I.getFalseValue(), &I);
+  }
+  void visitPHINode(PHINode &I) {
+    for (auto &op: I.incoming_values())
+      copy(op.get(), &I);
+  }
+  void visitCallInst(CallInst &I) {
+    auto callee = I.getCalledFunction();
+    if (callee == nullptr || callee->isDeclaration())
+      return;
+    auto arg = callee->arg_begin();
+    for (unsigned i = 0; i < I.arg_size() && arg != callee->arg_end(); ++i, ++arg)
+      copy(I.getArgOperand(i), &*arg);
+    addEdge(returnNode(callee), node(&I));
+  }
+  void visitReturnInst(ReturnInst &I) {
+    if (auto *value = I.getReturnValue()) {
+      unsigned v = node(value);
+      if (v != None)
+        addEdge(v, returnNode(I.getFunction()));
+    }
+  }
+  void visitInstruction(Instruction &I) {}
+
+private:
+  static constexpr unsigned None = ~0u;
+
+  struct Node {
+    PointsTo Pts;
+    // the part of Pts already sent along Succs
+    PointsTo Done;
+    // pts(s) ⊇ pts(this) for s in Succs
+    PointsTo Succs;
+    // pts(l) ⊇ pts(*o) and pts(*o) ⊇ pts(s) for o in pts(this)
+    std::vector<unsigned> Loads;
+    std::vector<unsigned> Stores;
+  };
+
+  // Look through constant casts and GEPs of globals
+  static Value * strip(Value * V) {
+    while (auto *CE = dyn_cast<ConstantExpr>(V)) {
+      if (!CE->isCast() && CE->getOpcode() != Instruction::GetElementPtr)
+        break;
+      V = CE->getOperand(0);
+    }
+    return V;
+  }
+
+  unsigned newNode() {
+    Nodes.emplace_back();
+    Rep.push_back(Rep.size());
+    return Nodes.size() - 1;
+  }
+
+  // The node of a pointer value, None for other constants
+  unsigned node(Value * V) {
+    V = strip(V);
+    if (!isa<Instruction>(V) && !isa<Argument>(V) && !isa<GlobalVariable>(V))
+      return None;
+    auto it = ValueToNode.find(V);
+    if (it != ValueToNode.end())
+      return it->second;
+    // the address of a global points to the global
+    unsigned o = isa<GlobalVariable>(V) ? object(V) : None;
+    unsigned n = newNode();
+    ValueToNode[V] = n;
+    if (o != None)
+      Nodes[n].Pts.set(o);
+    return n;
+  }
+
+  unsigned object(Value * V) {
+    auto it = ObjectIds.find(V);
+    if (it != ObjectIds.end())
+      return it->second;
+    unsigned o = Objects.size();
+    ObjectIds[V] = o;
+    Objects.push_back(V);
+    ObjectToContent.push_back(newNode());
+    return o;
+  }
+
+  unsigned content(unsigned o) const { return ObjectToContent[o]; }
+
+  unsigned returnNode(Function * F) {
+    auto it = ReturnNodes.find(F);
+    if (it != ReturnNodes.end())
+      return it->second;
+    return ReturnNodes[F] = newNode();
+  }
+
+  void copy(Value * from, Value * to) {
+    unsigned src = node(from);
+    if (src != None)
+      addEdge(src, node(to));
+  }
+
+  unsigned find(unsigned n) const {
+    while (Rep[n] != n)
+      n = Rep[n] = Rep[Rep[n]];
+    return n;
+  }
+
+  void push(unsigned n) {
+    if (Pending.size() <= n)
+      Pending.resize(Nodes.size());
+    if (!Pending.test(n)) {
+      Pending.set(n);
+      Worklist.push_back(n);
+    }
+  }
+
+  // Add pts(dst) ⊇ pts(src), sending src's whole set once
+  void addEdge(unsigned src, unsigned dst) {
+    src = find(src);
+    dst = find(dst);
+    if (src == dst || !Nodes[src].Succs.test_and_set(dst))
+      return;
+    if (Nodes[dst].Pts |= Nodes[src].Pts)
+      push(dst);
+  }
+
+  void solve() {
+    Pending.resize(Nodes.size());
+    for (unsigned n = 0; n < Nodes.size(); ++n) {
+      if (!Nodes[n].Pts.empty())
+        push(n);
+    }
+
+    std::vector<unsigned> candidates;
+    while (!Worklist.empty()) {
+      unsigned n = Worklist.front();
+      Worklist.pop_front();
+      Pending.reset(n);
+      if (find(n) != n)
+        continue;
+
+      PointsTo delta = Nodes[n].Pts;
+      delta.intersectWithComplement(Nodes[n].Done);
+      if (delta.empty())
+        continue;
+      Nodes[n].Done = Nodes[n].Pts;
+
+      // the new objects bring new edges through loads and stores
+      for (unsigned o: delta) {
+        unsigned c = content(o);
+        for (unsigned l: Nodes[n].Loads)
+          addEdge(c, l);
+        for (unsigned s: Nodes[n].Stores)
+          addEdge(s, c);
+      }
+
+      for (unsigned s: Nodes[n].Succs) {
+        unsigned z = find(s);
+        if (z == n)
+          continue;
+        if (Nodes[z].Pts |= delta)
+          push(z);
+        if (Nodes[z].Pts == Nodes[n].Pts && Checked.insert({n, z}).second)
+          candidates.push_back(z);
+      }
+      for (unsigned z: candidates)
+        collapseCycles(find(z));
+      candidates.clear();
+    }
+  }
+
+  // Tarjan's algorithm from root, merging each nontrivial SCC into one node
+  void collapseCycles(unsigned root) {
+    DenseMap<unsigned, unsigned> index, low;
+    std::vector<unsigned> stack;
+    DenseSet<unsigned> onStack;
+    std::vector<std::pair<unsigned, std::vector<unsigned>>> frames;
+    std::vector<std::vector<unsigned>> sccs;
+
+    unsigned visited = 0;
+    auto enter = [&](unsigned n) {
+      index[n] = low[n] = visited++;
+      stack.push_back(n);
+      onStack.insert(n);
+      std::vector<unsigned> succs;
+      for (unsigned s: Nodes[n].Succs) {
+        unsigned z = find(s);
+        if (z != n)
+          succs.push_back(z);
+      }
+      frames.push_back({n, std::move(succs)});
+    };
+
+    enter(root);
+    while (!frames.empty()) {
+      unsigned n = frames.back().first;
+      auto &succs = frames.back().second;
+      if (!succs.empty()) {
+        unsigned z = succs.back();
+        succs.pop_back();
+        if (!index.count(z))
+          enter(z);
+        else if (onStack.count(z))
+          low[n] = std::min(low[n], index[z]);
+        continue;
+      }
+      frames.pop_back();
+      if (!frames.empty()) {
+        unsigned parent = frames.back().first;
+        low[parent] = std::min(low[parent], low[n]);
+      }
+      if (low[n] == index[n]) {
+        std::vector<unsigned> scc;
+        unsigned m;
+        do {
+          m = stack.back();
+          stack.pop_back();
+          onStack.erase(m);
+          scc.push_back(m);
+        } while (m != n);
+        if (scc.size() > 1)
+          sccs.push_back(std::move(scc));
+      }
+    }
+
+    for (auto &scc: sccs) {
+      unsigned r = scc.front();
+      for (unsigned i = 1; i < scc.size(); ++i)
+        merge(r, scc[i]);
+      push(r);
+    }
+  }
+
+  void merge(unsigned r, unsigned n) {
+    Node &to = Nodes[r], &from = Nodes[n];
+    to.Pts |= from.Pts;
+    // only what both have sent is sure to be everywhere
+    to.Done &= from.Done;
+    to.Succs |= from.Succs;
+    to.Loads.insert(to.Loads.end(), from.Loads.begin(), from.Loads.end());
+    to.Stores.insert(to.Stores.end(), from.Stores.begin(), from.Stores.end());
+    from = Node();
+    Rep[n] = r;
+    NumCollapsed++;
+  }
+
+  std::vector<Node> Nodes;
+  mutable std::vector<unsigned> Rep;
+  DenseMap<Value *, unsigned> ValueToNode;
+  DenseMap<Function *, unsigned> ReturnNodes;
+  // objects by id, and the node of the content of each
+  std::vector<Value *> Objects;
+  DenseMap<Value *, unsigned> ObjectIds;
+  std::vector<unsigned> ObjectToContent;
+
+  std::deque<unsigned> Worklist;
+  BitVector Pending;
+  // edges already tested for a cycle
+  DenseSet<std::pair<unsigned, unsigned>> Checked;
+  unsigned NumCollapsed = 0;
+  PointsTo Empty;
+};
+
+}
+#endif // End LLVM_TRANSFORMS_231ANDERSEN_H
@@ -14,19 +14,68 @@
 #ifndef LLVM_TRANSFORMS_231DFA_H
 #define LLVM_TRANSFORMS_231DFA_H
 
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/InitializePasses.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Function.h"
+#include "llvm/Support/RecyclingAllocator.h"
 #include "llvm/Support/raw_ostream.h"
-#include <deque>
+#include <algorithm>
 #include <map>
 #include <utility>
 #include <vector>
 
 namespace llvm {
 
+/*
+ * The edges of the forward framework over F, from source to destination
+ * instruction: into the front of each block from its predecessors, from the
+ * first phi node to the first non-phi one, between the other consecutive
+ * instructions, and last the edge from the dummy node, null, to the entry.
+ */
+inline void forEachForwardEdge(Function & F, function_ref<void(Instruction *, Instruction *)> Edge) {
+  for (Function::iterator bi = F.begin(), e = F.end(); bi != e; ++bi) {
+    BasicBlock * block = &*bi;
+
+    Instruction * firstInstr = &(block->front());
+
+    // Incoming edges to the basic block
+    for (auto pi = pred_begin(block), pe = pred_end(block); pi != pe; ++pi) {
+      BasicBlock * prev = *pi;
+      Edge((Instruction *)prev->getTerminator(), firstInstr);
+    }
+
+    // If there is at least one phi node, an edge from the first phi node
+    // to the first non-phi node instruction in the basic block.
+    if (isa<PHINode>(firstInstr)) {
+      Edge(firstInstr, block->getFirstNonPHI());
+    }
+
+    // Edges within the basic block
+    for (auto ii = block->begin(), ie = block->end(); ii != ie; ++ii) {
+      Instruction * instr = &*ii;
+      if (isa<PHINode>(instr))
+        continue;
+      if (instr == (Instruction *)block->getTerminator())
+        break;
+      Edge(instr, instr->getNextNode());
+    }
+
+    // Outgoing edges of the basic block
+    Instruction * term = (Instruction *)block->getTerminator();
+    for (auto si = succ_begin(block), se = succ_end(block); si != se; ++si) {
+      BasicBlock * succ = *si;
+      Edge(term, &(succ->front()));
+    }
+  }
+
+  Edge(nullptr, &((F.front()).front()));
+}
+
 
 /*
  * This is the base class to represent information in a dataflow analysis.
@@ -36,15 +85,17 @@ class Info {
 public:
   Info() {}
   Info(const Info& other) {}
+  // Assignment copies the value only, never the reference count
+  Info& operator=(const Info& other) { return *this; }
   virtual ~Info() {};
 
   /*
-    * Print out the information
+    * Print out the information to OS
     *
     * Direction:
     *   In your subclass you should implement this function according to the project specifications.
     */
-  virtual void print() = 0;
+  virtual void print(raw_ostream & OS) = 0;
 
   /*
     * Compare two pieces of information
@@ -61,6 +112,58 @@ public:
     *   In your subclass you need to implement this function.
     */
   static Info* join(Info * info1, Info * info2, Info * result);
+
+private:
+  // Number of edges (and in-flight flow function results) sharing this object.
+  // It is maintained by DataFlowAnalysis.
+  unsigned RefCount = 0;
+
+  template <class, bool> friend class DataFlowAnalysis;
+};
+
+/*
+ * A worklist that pops the pending item with the lowest rank first and
+ * holds each item at most once. Items are 0 .. ranks.size() - 1.
+ */
+class OrderedWorklist {
+public:
+  void reset(const std::vector<unsigned> & ranks) {
+    Rank = ranks;
+    Heap.clear();
+    Pending.clear();
+    Pending.resize(Rank.size());
+  }
+
+  // Returns false if the item is already in the worklist
+  bool push(unsigned item) {
+    if (Pending.test(item))
+      return false;
+    Pending.set(item);
+    Heap.push_back(item);
+    std::push_heap(Heap.begin(), Heap.end(), ByRank{&Rank});
+    return true;
+  }
+
+  unsigned pop() {
+    std::pop_heap(Heap.begin(), Heap.end(), ByRank{&Rank});
+    unsigned item = Heap.back();
+    Heap.pop_back();
+    Pending.reset(item);
+    return item;
+  }
+
+  bool empty() const { return Heap.empty(); }
+
+private:
+  // Heap order that keeps the lowest rank on top
+  struct ByRank {
+    const std::vector<unsigned> * Rank;
+    bool operator()(unsigned a, unsigned b) const { return (*Rank)[a] > (*Rank)[b]; }
+  };
+
+  std::vector<unsigned> Rank;
+  std::vector<unsigned> Heap;
+  BitVector Pending;
 };
 
 /*
@@ -72,18 +175,42 @@ class DataFlowAnalysis {
 
 protected:
   typedef std::pair<unsigned, unsigned> Edge;
-	// Index to instruction map
-	std::map<unsigned, Instruction *> IndexToInstr;
+	// Index to instruction map, indices are dense in [0, IndexToInstr.size())
+	std::vector<Instruction *> IndexToInstr;
 	// Instruction to index map
-	std::map<Instruction *, unsigned> InstrToIndex;
+	DenseMap<Instruction *, unsigned> InstrToIndex;
+	// Pool of the information objects created by flow functions,
+	// recycled when released and freed in bulk with the analysis
+	RecyclingAllocator<BumpPtrAllocator, Info> InfoPool;
 	// Edge to information map
 	std::map<Edge, Info *> EdgeToInfo;
+	// Adjacency of the edges in EdgeToInfo in compressed sparse row form:
+	// the successors of node i are Succs[SuccBegin[i] .. SuccBegin[i + 1]),
+	// its predecessors are Preds[PredBegin[i] .. PredBegin[i + 1]).
+	// Both are sorted by index, the order a scan of EdgeToInfo would give.
+	std::vector<unsigned> SuccBegin, Succs;
+	std::vector<unsigned> PredBegin, Preds;
+	// SuccInfo[k] is the slot in EdgeToInfo of the k-th edge in Succs
+	std::vector<Info **> SuccInfo;
 	// The bottom of the lattice
 	Info Bottom;
 	// The initial state of the analysis
 	Info InitialState;
 	// EntryInstr points to the first instruction to be processed in the analysis
 	Instruction * EntryInstr;
+	// Run the worklist over basic blocks instead of single instructions
+	bool BlockSolver;
+	// False while the edges inside basic blocks do not hold their results yet
+	bool Materialized;
+	// Block solver only: the nodes of each basic block in the order the
+	// information flows through them, and the block each node belongs to
+	std::vector<std::vector<unsigned>> BlockNodes;
+	std::vector<unsigned> NodeToBlock;
+	// Rank of each node in reverse postorder of the edges, see computeNodeRanks
+	std::vector<unsigned> NodeRank;
+	// Number of worklist pops and flow function applications of the last run
+	unsigned NumIterations;
+	unsigned NumVisits;
 
 
   /*
@@ -99,16 +226,22 @@ protected:
     *   indices to the instructions of a function.
     */
   void assignIndiceToInstrs(Function * F) {
+    unsigned numInstrs = 0;
+    for (BasicBlock &BB : *F)
+      numInstrs += BB.size();
+    IndexToInstr.reserve(numInstrs + 1);
+    InstrToIndex.reserve(numInstrs + 1);
+
     // Dummy instruction null has index 0;
     // Any real instruction's index > 0.
     InstrToIndex[nullptr] = 0;
-    IndexToInstr[0] = nullptr;
+    IndexToInstr.push_back(nullptr);
 
     unsigned counter = 1;
     for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
       Instruction * instr = &*I;
       InstrToIndex[instr] = counter;
-      IndexToInstr[counter] = instr;
+      IndexToInstr.push_back(instr);
       counter++;
     }
     return;
@@ -122,10 +255,9 @@ protected:
   void getIncomingEdges(unsigned index, std::vector<unsigned> * IncomingEdges) {
     assert(IncomingEdges->size() == 0 && "IncomingEdges should be empty.");
 
-    for (auto const &it : EdgeToInfo) {
-      if (it.first.second == index)
-        IncomingEdges->push_back(it.first.first);
-    }
+    IncomingEdges->insert(IncomingEdges->end(),
+                          Preds.begin() + PredBegin[index],
+                          Preds.begin() + PredBegin[index + 1]);
     return;
   }
 
@@ -137,10 +269,9 @@ protected:
   void getOutgoingEdges(unsigned index, std::vector<unsigned> * OutgoingEdges) {
     assert(OutgoingEdges->size() == 0 && "OutgoingEdges should be empty.");
 
-    for (auto const &it : EdgeToInfo) {
-      if (it.first.first == index)
-        OutgoingEdges->push_back(it.first.second);
-    }
+    OutgoingEdges->insert(OutgoingEdges->end(),
+                          Succs.begin() + SuccBegin[index],
+                          Succs.begin() + SuccBegin[index + 1]);
     return;
   }
 
@@ -157,53 +288,94 @@ protected:
   }
 
   /*
-    * Initialize EdgeToInfo and EntryInstr for a forward analysis.
+    * Utility function:
+    *   Build the adjacency arrays from EdgeToInfo once all edges are added,
+    *   so that the edges of a node can be queried in O(degree).
     */
-  void initializeForwardMap(Function * func) {
-    assignIndiceToInstrs(func);
-
-    for (Function::iterator bi = func->begin(), e = func->end(); bi != e; ++bi) {
-      BasicBlock * block = &*bi;
-
-      Instruction * firstInstr = &(block->front());
-
-      // Initialize incoming edges to the basic block
-      for (auto pi = pred_begin(block), pe = pred_end(block); pi != pe; ++pi) {
-        BasicBlock * prev = *pi;
-        Instruction * src = (Instruction *)prev->getTerminator();
-        Instruction * dst = firstInstr;
-        addEdge(src, dst, &Bottom);
-      }
+  void buildAdjacency() {
+    unsigned numNodes = IndexToInstr.size();
+    SuccBegin.assign(numNodes + 1, 0);
+    PredBegin.assign(numNodes + 1, 0);
+    for (auto const &it : EdgeToInfo) {
+      ++SuccBegin[it.first.first + 1];
+      ++PredBegin[it.first.second + 1];
+    }
+    for (unsigned i = 0; i < numNodes; ++i) {
+      SuccBegin[i + 1] += SuccBegin[i];
+      PredBegin[i + 1] += PredBegin[i];
+    }
 
-      // If there is at least one phi node, add an edge from the first phi node
-      // to the first non-phi node instruction in the basic block.
-      if (isa<PHINode>(firstInstr)) {
-        addEdge(firstInstr, block->getFirstNonPHI(), &Bottom);
-      }
+    Succs.resize(EdgeToInfo.size());
+    SuccInfo.resize(EdgeToInfo.size());
+    Preds.resize(EdgeToInfo.size());
+    // EdgeToInfo is sorted by (src, dst), so the successors come out grouped
+    // by source and the predecessors of each node come out in source order.
+    std::vector<unsigned> predFill(PredBegin.begin(), PredBegin.end() - 1);
+    unsigned k = 0;
+    for (auto &it : EdgeToInfo) {
+      Succs[k] = it.first.second;
+      SuccInfo[k] = &it.second;
+      ++k;
+      Preds[predFill[it.first.second]++] = it.first.first;
+    }
+    return;
+  }
 
-      // Initialize edges within the basic block
-      for (auto ii = block->begin(), ie = block->end(); ii != ie; ++ii) {
-        Instruction * instr = &*ii;
-        if (isa<PHINode>(instr))
-          continue;
-        if (instr == (Instruction *)block->getTerminator())
-          break;
-        Instruction * next = instr->getNextNode();
-        addEdge(instr, next, &Bottom);
+  /*
+    * Utility function:
+    *   Rank the nodes in reverse postorder of the edges, starting from the
+    *   dummy node. The edges of a backward analysis already run against the
+    *   control flow, so this is the postorder of the CFG in that case.
+    *   Nodes not reachable from the dummy node are ranked last, by index.
+    */
+  void computeNodeRanks() {
+    unsigned numNodes = IndexToInstr.size();
+    std::vector<unsigned> postorder;
+    std::vector<bool> visited(numNodes, false);
+    // (node, position of the next successor to visit)
+    std::vector<std::pair<unsigned, unsigned>> stack;
+
+    postorder.reserve(numNodes);
+    visited[0] = true;
+    stack.push_back({0, SuccBegin[0]});
+    while (!stack.empty()) {
+      unsigned node = stack.back().first;
+      unsigned pos = stack.back().second;
+      if (pos == SuccBegin[node + 1]) {
+        postorder.push_back(node);
+        stack.pop_back();
+        continue;
       }
-
-      // Initialize outgoing edges of the basic block
-      Instruction * term = (Instruction *)block->getTerminator();
-      for (auto si = succ_begin(block), se = succ_end(block); si != se; ++si) {
-        BasicBlock * succ = *si;
-        Instruction * next = &(succ->front());
-        addEdge(term, next, &Bottom);
+      stack.back().second++;
+      unsigned next = Succs[pos];
+      if (!visited[next]) {
+        visited[next] = true;
+        stack.push_back({next, SuccBegin[next]});
       }
+    }
 
+    NodeRank.assign(numNodes, 0);
+    unsigned rank = 0;
+    for (auto it = postorder.rbegin(); it != postorder.rend(); ++it)
+      NodeRank[*it] = rank++;
+    for (unsigned i = 0; i < numNodes; ++i) {
+      if (!visited[i])
+        NodeRank[i] = rank++;
     }
+    return;
+  }
+
+  /*
+    * Initialize EdgeToInfo and EntryInstr for a forward analysis.
+    */
+  void initializeForwardMap(Function * func) {
+    assignIndiceToInstrs(func);
 
     EntryInstr = (Instruction *) &((func->front()).front());
-    addEdge(nullptr, EntryInstr, &InitialState);
+    forEachForwardEdge(*func, [&](Instruction * src, Instruction * dst) {
+      addEdge(src, dst, src ? &Bottom : &InitialState);
+    });
+    buildAdjacency();
 
     return;
   }
@@ -245,10 +417,202 @@ protected:
 
     EntryInstr = (Instruction *) &((func->back()).back());
     addEdge(nullptr, EntryInstr, &InitialState);
+    buildAdjacency();
 
     return;
   }
 
+  /*
+    * Utility function:
+    *   Create a piece of information in the pool of the analysis.
+    *   Flow functions must create their results with it, and may put the
+    *   same object on several outgoing edges instead of copying it.
+    */
+  template <typename... Args>
+  Info * newInfo(Args &&... args) {
+    return new (InfoPool.Allocate()) Info(std::forward<Args>(args)...);
+  }
+
+  /*
+    * Utility functions:
+    *   Take and drop a reference to a piece of information created by
+    *   newInfo. It returns to the pool when the last reference is dropped.
+    *   Bottom and InitialState are owned by the analysis itself.
+    */
+  void retainInfo(Info * info) {
+    if (info != &Bottom && info != &InitialState)
+      info->RefCount++;
+  }
+
+  void releaseInfo(Info * info) {
+    if (info == &Bottom || info == &InitialState)
+      return;
+    assert(info->RefCount > 0 && "Releasing an unreferenced Info.");
+    if (--info->RefCount == 0) {
+      info->~Info();
+      InfoPool.Deallocate(info);
+    }
+  }
+
+  /*
+    * Group the nodes by basic block for the block solver.
+    * Non-leader phi nodes have no edges and are left out of BlockNodes.
+    */
+  void initializeBlocks(Function * func) {
+    BlockNodes.clear();
+    NodeToBlock.assign(IndexToInstr.size(), ~0u);
+
+    for (BasicBlock &BB : *func) {
+      std::vector<unsigned> nodes;
+      if (isa<PHINode>(BB.front()))
+        nodes.push_back(InstrToIndex[&BB.front()]);
+      for (auto ii = BB.getFirstNonPHI()->getIterator(), ie = BB.end(); ii != ie; ++ii)
+        nodes.push_back(InstrToIndex[&*ii]);
+      if (!Direction)
+        std::reverse(nodes.begin(), nodes.end());
+
+      for (Instruction &I : BB)
+        NodeToBlock[InstrToIndex[&I]] = BlockNodes.size();
+      BlockNodes.push_back(std::move(nodes));
+    }
+    return;
+  }
+
+  /*
+    * Store the results of node cur of block b on its outgoing edges.
+    * An edge leaving the block is only updated when its information changes,
+    * and the block it enters is then added to ChangedBlocks.
+    * Edges inside the block are always overwritten.
+    */
+  void updateBlockEdges(unsigned b, unsigned cur, std::vector<unsigned> & outgoingEdges,
+                        std::vector<Info *> & outInfo, std::vector<unsigned> * ChangedBlocks) {
+    unsigned head = BlockNodes[b].front();
+
+    for (Info * info : outInfo)
+      retainInfo(info);
+    for (size_t i = 0; i < outInfo.size(); ++i) {
+      auto &infoOnEdge = *SuccInfo[SuccBegin[cur] + i];
+      unsigned dst = outgoingEdges[i];
+      bool inner = NodeToBlock[dst] == b && dst != head;
+
+      if (inner || !Info::equals(outInfo[i], infoOnEdge)) {
+        retainInfo(outInfo[i]);
+        releaseInfo(infoOnEdge);
+        infoOnEdge = outInfo[i];
+        if (!inner && ChangedBlocks)
+          ChangedBlocks->push_back(NodeToBlock[dst]);
+      }
+    }
+    for (Info * info : outInfo)
+      releaseInfo(info);
+    return;
+  }
+
+  /*
+    * Apply the flow function to the nodes of block b in flow order.
+    * Unless keepInner is set, the edges inside the block are reset to bottom
+    * afterwards so that only the block boundaries keep information while the
+    * solver runs. In that case a blockflowfunction summary of the block, if
+    * the subclass provides one, replaces the sweep; the fallback costs as
+    * much as the instruction solver.
+    */
+  void sweepBlock(unsigned b, bool keepInner, std::vector<unsigned> * ChangedBlocks) {
+    std::vector<unsigned> incomingEdges;
+    std::vector<unsigned> outgoingEdges;
+    std::vector<Info *>   outInfo;
+    unsigned head = BlockNodes[b].front();
+    unsigned tail = BlockNodes[b].back();
+
+    if (!keepInner) {
+      getIncomingEdges(head, &incomingEdges);
+      getOutgoingEdges(tail, &outgoingEdges);
+      if (!incomingEdges.empty() &&
+          blockflowfunction(IndexToInstr[head], IndexToInstr[tail], incomingEdges, outgoingEdges, outInfo)) {
+        NumVisits++;
+        updateBlockEdges(b, tail, outgoingEdges, outInfo, ChangedBlocks);
+        return;
+      }
+      outInfo.clear();
+      incomingEdges.clear();
+      outgoingEdges.clear();
+    }
+
+    for (unsigned cur : BlockNodes[b]) {
+      getIncomingEdges(cur, &incomingEdges);
+      getOutgoingEdges(cur, &outgoingEdges);
+      // same rule as the instruction solver: skip 0-indegree or 0-outdegree nodes
+      if (!incomingEdges.empty() && !outgoingEdges.empty()) {
+        flowfunction(IndexToInstr[cur], incomingEdges, outgoingEdges, outInfo);
+        NumVisits++;
+        updateBlockEdges(b, cur, outgoingEdges, outInfo, ChangedBlocks);
+      }
+
+      outInfo.clear();
+      incomingEdges.clear();
+      outgoingEdges.clear();
+    }
+
+    if (keepInner)
+      return;
+
+    for (unsigned cur : BlockNodes[b]) {
+      for (unsigned k = SuccBegin[cur]; k != SuccBegin[cur + 1]; ++k) {
+        if (NodeToBlock[Succs[k]] == b && Succs[k] != head) {
+          releaseInfo(*SuccInfo[k]);
+          *SuccInfo[k] = &Bottom;
+        }
+      }
+    }
+    return;
+  }
+
+  /*
+    * The worklist algorithm over basic blocks.
+    * Only the edges between blocks hold information when it returns;
+    * materialize() fills in the edges inside the blocks.
+    */
+  void runBlockWorklistAlgorithm(Function * func) {
+    OrderedWorklist worklist;
+    std::vector<unsigned> changedBlocks;
+
+    initializeBlocks(func);
+    // blocks are visited in the order of their first node
+    std::vector<unsigned> blockRank(BlockNodes.size());
+    for (unsigned b = 0; b < BlockNodes.size(); ++b) {
+      blockRank[b] = NodeRank[BlockNodes[b].front()];
+    }
+    worklist.reset(blockRank);
+    for (unsigned b = 0; b < BlockNodes.size(); ++b) {
+      worklist.push(b);
+    }
+
+    while (!worklist.empty()) {
+      unsigned b = worklist.pop();
+      NumIterations++;
+
+      sweepBlock(b, false, &changedBlocks);
+      for (unsigned succ : changedBlocks) {
+        worklist.push(succ);
+      }
+      changedBlocks.clear();
+    }
+
+    Materialized = false;
+    return;
+  }
+
+  /*
+    * Compute the information on the edges inside basic blocks from the
+    * converged block boundaries, with one more sweep over each block.
+    */
+  void materialize() {
+    for (unsigned b = 0; b < BlockNodes.size(); ++b) {
+      sweepBlock(b, true, nullptr);
+    }
+    Materialized = true;
+    return;
+  }
+
   /*
     * The flow function.
     *   Instruction I: the IR instruction to be processed.
@@ -262,11 +626,71 @@ protected:
   virtual void flowfunction(Instruction * I, std::vector<unsigned> & IncomingEdges,
                             std::vector<unsigned> & OutgoingEdges, std::vector<Info *> & Infos) = 0;
 
+  /*
+    * The block flow function, used by the block solver while it iterates.
+    *   Instruction First, Last: the first and last node of a basic block, in flow order.
+    *   std::vector<unsigned> & IncomingEdges: the sources of the incoming edges of First.
+    *   std::vector<unsigned> & OutgoingEdges: the destinations of the outgoing edges of Last.
+    *   std::vector<Info *> & Infos: the newly computed information for each outgoing edge of Last.
+    *
+    * Direction:
+    *   Optional. Override it when the transfer of a whole block can be summarized;
+    *   return false to have the flow function applied to each node instead.
+    */
+  virtual bool blockflowfunction(Instruction * First, Instruction * Last, std::vector<unsigned> & IncomingEdges,
+                                 std::vector<unsigned> & OutgoingEdges, std::vector<Info *> & Infos) {
+    return false;
+  }
+
+  /*
+    * Called once the instructions are numbered and the edges are built,
+    * before the worklist starts.
+    *
+    * Direction:
+    *   Optional. Override it to precompute per-instruction or per-block data.
+    */
+  virtual void prepare(Function * func) {}
+
   public:
     DataFlowAnalysis(Info & bottom, Info & initialState)
-      :Bottom(bottom), InitialState(initialState), EntryInstr(nullptr) {}
+      :Bottom(bottom), InitialState(initialState), EntryInstr(nullptr),
+       BlockSolver(false), Materialized(true), NumIterations(0), NumVisits(0) {}
+
+    virtual ~DataFlowAnalysis() {
+      for (auto &it : EdgeToInfo)
+        releaseInfo(it.second);
+    }
+
+    /*
+     * Solve at basic block granularity: the worklist holds blocks and each
+     * visit applies the blockflowfunction summary of the block. The results
+     * are the same; per-instruction information is only kept once print() or
+     * getEdgeInfo() asks for it. Without a summary every visit still applies
+     * the flow function to each node, so only enable it for analyses that
+     * override blockflowfunction. Call it before runWorklistAlgorithm.
+     */
+    void setBlockSolver(bool on) {
+      BlockSolver = on;
+    }
 
-    virtual ~DataFlowAnalysis() {}
+    /*
+     * Convergence counters of the last runWorklistAlgorithm:
+     * the number of nodes (or blocks) taken off the worklist, and the number
+     * of flow function applications, including the sweep of materialize().
+     */
+    unsigned getNumIterations() const { return NumIterations; }
+    unsigned getNumVisits() const { return NumVisits; }
+
+    /*
+     * Get the information on the edge src -> dst after the analysis has run,
+     * or nullptr if there is no such edge.
+     */
+    Info * getEdgeInfo(Instruction * src, Instruction * dst) {
+      if (!Materialized)
+        materialize();
+      auto it = EdgeToInfo.find({InstrToIndex.lookup(src), InstrToIndex.lookup(dst)});
+      return it == EdgeToInfo.end() ? nullptr : it->second;
+    }
 
     /*
      * Print out the analysis results.
@@ -276,9 +700,16 @@ protected:
      * 	 The autograder will check the output of this function.
      */
     void print() {
+      print(errs());
+    }
+
+    // The same output to another stream, e.g. a per-function buffer
+    virtual void print(raw_ostream & OS) {
+      if (!Materialized)
+        materialize();
       for (auto const &it: EdgeToInfo) {
-        errs() << "Edge " << it.first.first << "->" "Edge " << it.first.second << ":";
-        (it.second)->print();
+        OS << "Edge " << it.first.first << "->" "Edge " << it.first.second << ":";
+        (it.second)->print(OS);
       }
     }
 
@@ -293,7 +724,7 @@ protected:
      *   You may not change anything before "// (2) Initialize the worklist".
      */
     void runWorklistAlgorithm(Function * func) {
-    	std::deque<unsigned> worklist;
+    	OrderedWorklist worklist;
 
     	// (1) Initialize info of each edge to bottom
     	if (Direction)
@@ -303,9 +734,23 @@ protected:
 
     	assert(EntryInstr != nullptr && "Entry instruction is null.");
 
+      prepare(func);
+
+      // Forward analyses visit nodes in reverse postorder, backward analyses
+      // in postorder of the CFG; a node is never queued twice.
+      computeNodeRanks();
+      NumIterations = 0;
+      NumVisits = 0;
+
+      if (BlockSolver) {
+        runBlockWorklistAlgorithm(func);
+        return;
+      }
+
     	// (2) Initialize the work list
-      for (auto &kv: IndexToInstr) {
-        worklist.push_back(kv.first);
+      worklist.reset(NodeRank);
+      for (unsigned i = 0; i < IndexToInstr.size(); ++i) {
+        worklist.push(i);
       }
 
     	// (3) Compute until the work list is empty
@@ -314,8 +759,8 @@ protected:
 			std::vector<Info*>    outInfo;
 
       while (!worklist.empty()) {
-        unsigned cur = worklist.front();
-				worklist.pop_front();
+        unsigned cur = worklist.pop();
+        NumIterations++;
 
         getIncomingEdges(cur, &incomingEdges);
 				getOutgoingEdges(cur, &outgoingEdges);
@@ -328,19 +773,24 @@ protected:
         }
 
 				flowfunction(IndexToInstr[cur], incomingEdges, outgoingEdges, outInfo);
+				NumVisits++;
 
+				// hold the results while comparing them, since several outgoing
+				// edges may share one object; the unused ones go back to the pool
+				for (Info * info : outInfo)
+					retainInfo(info);
 				for (size_t i = 0; i < outInfo.size(); ++i) {
-					auto &infoOnEdge = EdgeToInfo.at({cur, outgoingEdges[i]});
+					auto &infoOnEdge = *SuccInfo[SuccBegin[cur] + i];
 
 					if (!Info::equals(outInfo[i], infoOnEdge)) {
-						if (infoOnEdge != &Bottom && infoOnEdge != &InitialState)
-							delete infoOnEdge;
+						retainInfo(outInfo[i]);
+						releaseInfo(infoOnEdge);
 						infoOnEdge = outInfo[i];
-						worklist.push_back(outgoingEdges[i]);
-					} else {
-						delete outInfo[i];
+						worklist.push(outgoingEdges[i]);
 					}
 				}
+				for (Info * info : outInfo)
+					releaseInfo(info);
 
 				outInfo.clear();
 				incomingEdges.clear();
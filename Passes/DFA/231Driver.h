@@ -0,0 +1,81 @@
+//===- 231Driver.h - Module driver for CSE 231 projects ---------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file runs a per-function analysis over a whole module on a pool of
+// threads, keeping the output in the order of the functions in the module.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_231DRIVER_H
+#define LLVM_TRANSFORMS_231DRIVER_H
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace llvm {
+
+/*
+ * Call Analyze(F, OS) for every function with a body in M, using Threads
+ * threads (0 for one per hardware thread). The output of each function is
+ * buffered, and the buffers are written to errs() in module order as soon as
+ * all the functions before them are done, so the output does not depend on
+ * the number of threads.
+ *
+ * Analyze runs concurrently on different functions: it may read the IR and
+ * any state shared by the pass, but must not modify either.
+ */
+template <class Callable>
+void runOnFunctions(Module & M, unsigned Threads, Callable Analyze) {
+  std::vector<Function *> funcs;
+  for (auto &F: M) {
+    if (!F.isDeclaration())
+      funcs.push_back(&F);
+  }
+
+  // errs() is unbuffered, so the serial path also writes one buffer per function
+  std::vector<std::string> buffers(funcs.size());
+  if (Threads == 0)
+    Threads = std::max(1u, std::thread::hardware_concurrency());
+  if (Threads == 1 || funcs.size() < 2) {
+    for (size_t i = 0; i < funcs.size(); ++i) {
+      raw_string_ostream OS(buffers[i]);
+      Analyze(*funcs[i], OS);
+      errs() << OS.str();
+      std::string().swap(buffers[i]);
+    }
+    return;
+  }
+
+  std::vector<std::shared_future<void>> done;
+  done.reserve(funcs.size());
+  ThreadPool pool(Threads);
+  for (size_t i = 0; i < funcs.size(); ++i) {
+    done.push_back(pool.async([&, i] {
+      raw_string_ostream OS(buffers[i]);
+      Analyze(*funcs[i], OS);
+      OS.flush();
+    }));
+  }
+  for (size_t i = 0; i < funcs.size(); ++i) {
+    done[i].wait();
+    errs() << buffers[i];
+    std::string().swap(buffers[i]);
+  }
+  pool.wait();
+}
+
+}
+#endif // End LLVM_TRANSFORMS_231DRIVER_H
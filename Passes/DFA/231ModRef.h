@@ -0,0 +1,237 @@
+//===- 231ModRef.h - Global MOD/REF for CSE 231 projects --------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file computes the global variables each function of a module may
+// modify (MOD) and read (REF), including through the functions it calls.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_231MODREF_H
+#define LLVM_TRANSFORMS_231MODREF_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include <set>
+#include <vector>
+
+namespace llvm {
+
+/*
+ * Whether V, a global or an alloca, is only read and written by simple loads
+ * and stores of its own address, so that no pointer to it exists.
+ */
+inline bool isOnlyLoadedAndStored(const Value * V) {
+  for (auto *U: V->users()) {
+    if (auto *load = dyn_cast<LoadInst>(U)) {
+      if (!load->isSimple())
+        return false;
+    } else if (auto *store = dyn_cast<StoreInst>(U)) {
+      if (!store->isSimple() || store->getValueOperand() == V)
+        return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * MOD and REF of every function of a module, as bit-vectors over a dense id
+ * of the global variables (their order in the module).
+ *
+ * Locally, a function modifies the globals it stores to and reads the
+ * globals it loads from. A store or load through a loaded pointer may
+ * touch any global in MPT, the values that may be modified through a
+ * pointer. A function then also touches whatever its callees touch, which
+ * is propagated once bottom-up over the SCCs of the call graph: all the
+ * functions of an SCC end with the same sets.
+ *
+ * By default, calls to declarations and indirect calls are assumed to touch
+ * no global, as the course analyses do. With UnknownCalls, which a transform
+ * needs, they may touch every global that code outside the module could
+ * reach: all but the internal globals that are only loaded and stored, plus
+ * whatever the functions it can call back touch, those that are visible
+ * outside the module or whose address is taken. propagate(CallGraph &)
+ * repeats until that set is stable.
+ * (The name avoids llvm::ModRefInfo, the result enum of alias analysis.)
+ */
+class GlobalModRefInfo {
+public:
+  // Number the globals of M and compute the local MOD and REF of its functions
+  GlobalModRefInfo(Module & M, const std::set<Value *> & MPT, bool UnknownCalls = false) {
+    for (auto &G: M.globals()) {
+      GlobalID[&G] = Globals.size();
+      Globals.push_back(&G);
+    }
+    Empty.resize(Globals.size());
+    Unknown.resize(Globals.size());
+    if (UnknownCalls) {
+      for (unsigned id = 0; id < Globals.size(); ++id) {
+        if (!Globals[id]->hasLocalLinkage() || !isOnlyLoadedAndStored(Globals[id]))
+          Unknown.set(id);
+      }
+    }
+
+    BitVector mptGlobals(Globals.size());
+    for (auto *V: MPT) {
+      if (auto *G = dyn_cast<GlobalVariable>(V))
+        mptGlobals.set(getGlobalID(G));
+    }
+
+    for (auto &F: M) {
+      FuncIndex[&F] = Mod.size();
+      Mod.emplace_back(Globals.size());
+      Ref.emplace_back(Globals.size());
+      if (F.isDeclaration()) {
+        Declarations.push_back(&F);
+        continue;
+      }
+      if (UnknownCalls && (!F.hasLocalLinkage() || F.hasAddressTaken()))
+        Callbacks.push_back(&F);
+      for (auto &BB: F) {
+        for (auto &I: BB) {
+          if (auto *store = dyn_cast<StoreInst>(&I))
+            addLocal(Mod.back(), store->getPointerOperand(), mptGlobals);
+          else if (auto *load = dyn_cast<LoadInst>(&I))
+            addLocal(Ref.back(), load->getPointerOperand(), mptGlobals);
+        }
+      }
+    }
+    for (auto *F: Callbacks) {
+      Unknown |= getMod(F);
+      Unknown |= getRef(F);
+    }
+    setDeclarations();
+  }
+
+  /*
+   * Add the callees of the functions of an SCC to their sets. The SCCs they
+   * call must have been propagated already, as in a bottom-up traversal.
+   */
+  void propagate(ArrayRef<CallGraphNode *> SCC) {
+    BitVector mod(Globals.size()), ref(Globals.size());
+    for (auto *node: SCC) {
+      if (!node->getFunction())
+        continue;
+      mod |= getMod(node->getFunction());
+      ref |= getRef(node->getFunction());
+      for (auto &record: *node) {
+        // an indirect call is an edge to the null function
+        auto *callee = record.second->getFunction();
+        mod |= callee ? getMod(callee) : Unknown;
+        ref |= callee ? getRef(callee) : Unknown;
+      }
+    }
+    for (auto *node: SCC) {
+      auto it = FuncIndex.find(node->getFunction());
+      if (it == FuncIndex.end())
+        continue;
+      Mod[it->second] = mod;
+      Ref[it->second] = ref;
+    }
+  }
+
+  // Propagate all the SCCs of CG bottom-up, until the callbacks are stable
+  void propagate(CallGraph & CG) {
+    while (true) {
+      for (auto I = scc_begin(&CG); !I.isAtEnd(); ++I)
+        propagate(*I);
+      BitVector unknown = Unknown;
+      for (auto *F: Callbacks) {
+        unknown |= getMod(F);
+        unknown |= getRef(F);
+      }
+      if (unknown == Unknown)
+        return;
+      Unknown = unknown;
+      setDeclarations();
+    }
+  }
+
+  unsigned getNumGlobals() const { return Globals.size(); }
+  GlobalVariable * getGlobal(unsigned ID) const { return Globals[ID]; }
+  unsigned getGlobalID(const GlobalVariable * G) const {
+    auto it = GlobalID.find(G);
+    assert(it != GlobalID.end() && "Global of another module.");
+    return it->second;
+  }
+
+  // The ids of the globals F may modify and read
+  const BitVector & getMod(const Function * F) const {
+    auto it = FuncIndex.find(F);
+    return it == FuncIndex.end() ? Empty : Mod[it->second];
+  }
+  const BitVector & getRef(const Function * F) const {
+    auto it = FuncIndex.find(F);
+    return it == FuncIndex.end() ? Empty : Ref[it->second];
+  }
+
+  bool mayModify(const Function * F, const GlobalVariable * G) const {
+    return getMod(F).test(getGlobalID(G));
+  }
+  bool mayRead(const Function * F, const GlobalVariable * G) const {
+    return getRef(F).test(getGlobalID(G));
+  }
+
+  // The ids of the globals a call may modify and read
+  const BitVector & getMod(const CallBase & Call) const {
+    auto *F = Call.getCalledFunction();
+    return F ? getMod(F) : Unknown;
+  }
+  const BitVector & getRef(const CallBase & Call) const {
+    auto *F = Call.getCalledFunction();
+    return F ? getRef(F) : Unknown;
+  }
+
+  bool mayModify(const CallBase & Call, const GlobalVariable * G) const {
+    return getMod(Call).test(getGlobalID(G));
+  }
+  bool mayRead(const CallBase & Call, const GlobalVariable * G) const {
+    return getRef(Call).test(getGlobalID(G));
+  }
+
+private:
+  // What a declaration touches, from its attributes
+  void setDeclarations() {
+    for (auto *F: Declarations) {
+      auto index = FuncIndex.lookup(F);
+      if (!F->doesNotAccessMemory())
+        Ref[index] |= Unknown;
+      if (!F->onlyReadsMemory())
+        Mod[index] |= Unknown;
+    }
+  }
+
+  // A direct access to a global, or any global of MPT through a loaded pointer
+  void addLocal(BitVector & Set, Value * Ptr, const BitVector & MPTGlobals) {
+    if (auto *G = dyn_cast<GlobalVariable>(Ptr))
+      Set.set(getGlobalID(G));
+    else if (isa<LoadInst>(Ptr))
+      Set |= MPTGlobals;
+  }
+
+  std::vector<GlobalVariable *> Globals;
+  DenseMap<const GlobalVariable *, unsigned> GlobalID;
+  DenseMap<const Function *, unsigned> FuncIndex;
+  std::vector<BitVector> Mod, Ref;
+  BitVector Empty;
+  // what calls to unknown code may touch
+  BitVector Unknown;
+  std::vector<Function *> Declarations;
+  // the functions unknown code may call
+  std::vector<Function *> Callbacks;
+};
+
+}
+#endif // End LLVM_TRANSFORMS_231MODREF_H
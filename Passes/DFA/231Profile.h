@@ -0,0 +1,647 @@
+//===- 231Profile.h - Counter code generation for CSE 231 -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file emits the counter arrays, constant tables and report loops the
+// part1 profilers share.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_231PROFILE_H
+#define LLVM_TRANSFORMS_231PROFILE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+// Emit `for (i = Begin; i < End; ++i) Body(i)`, leaving Builder after the loop
+inline void emitLoop(IRBuilder<> & Builder, Value * Begin, Value * End,
+                     function_ref<void(Value *)> Body) {
+  auto *pre = Builder.GetInsertBlock();
+  auto *F = pre->getParent();
+  auto &CTX = F->getContext();
+  auto *head = BasicBlock::Create(CTX, "loop", F);
+  auto *body = BasicBlock::Create(CTX, "loop.body", F);
+  auto *exit = BasicBlock::Create(CTX, "loop.end", F);
+  Builder.CreateBr(head);
+
+  Builder.SetInsertPoint(head);
+  auto *i = Builder.CreatePHI(Begin->getType(), 2);
+  i->addIncoming(Begin, pre);
+  Builder.CreateCondBr(Builder.CreateICmpULT(i, End), body, exit);
+
+  Builder.SetInsertPoint(body);
+  Body(i);
+  i->addIncoming(Builder.CreateAdd(i, ConstantInt::get(i->getType(), 1)), Builder.GetInsertBlock());
+  Builder.CreateBr(head);
+  Builder.SetInsertPoint(exit);
+}
+
+// An internal constant i32 array
+inline GlobalVariable * createTable(Module & M, ArrayRef<unsigned> Elements, const Twine & Name) {
+  auto *i32 = Type::getInt32Ty(M.getContext());
+  std::vector<Constant *> elements;
+  for (auto e: Elements)
+    elements.push_back(ConstantInt::get(i32, e));
+  auto *type = ArrayType::get(i32, elements.size());
+  return new GlobalVariable(M, type, true, GlobalVariable::InternalLinkage,
+                            ConstantArray::get(type, elements), Name);
+}
+
+// An internal zero-initialized array of N elements of type Ty
+inline GlobalVariable * createArray(Module & M, Type * Ty, unsigned N, const Twine & Name) {
+  auto *type = ArrayType::get(Ty, N);
+  return new GlobalVariable(M, type, false, GlobalVariable::InternalLinkage,
+                            ConstantAggregateZero::get(type), Name);
+}
+
+// The address of element I of the global array Array
+inline Value * emitElement(IRBuilder<> & Builder, GlobalVariable * Array, Value * I) {
+  return Builder.CreateInBoundsGEP(Array->getValueType(), Array, {Builder.getInt32(0), I});
+}
+
+inline Value * emitLoad(IRBuilder<> & Builder, GlobalVariable * Array, Value * I) {
+  auto *type = cast<ArrayType>(Array->getValueType())->getElementType();
+  return Builder.CreateLoad(type, emitElement(Builder, Array, I));
+}
+
+// Counters[I] += 1, inline
+inline void emitIncrement(IRBuilder<> & Builder, GlobalVariable * Counters, Value * I) {
+  auto *counter = emitElement(Builder, Counters, I);
+  auto *type = cast<ArrayType>(Counters->getValueType())->getElementType();
+  auto *count = Builder.CreateLoad(type, counter);
+  Builder.CreateStore(Builder.CreateAdd(count, ConstantInt::get(type, 1)), counter);
+}
+
+inline void emitIncrement(IRBuilder<> & Builder, GlobalVariable * Counters, unsigned I) {
+  emitIncrement(Builder, Counters, Builder.getInt32(I));
+}
+
+// How instrumented code that may run on several threads updates its counters
+enum class CounterSharing { Plain, Atomic, Shards };
+
+// The values of the options that choose a CounterSharing
+inline cl::ValuesClass counterSharingValues() {
+  return cl::values(
+      clEnumValN(CounterSharing::Plain, "plain", "Plain increments, for single-threaded programs"),
+      clEnumValN(CounterSharing::Atomic, "atomic", "Relaxed atomic increments of the shared counters"),
+      clEnumValN(CounterSharing::Shards, "shards", "Per-thread counter shards, merged when reporting"));
+}
+
+/*
+ * An i64 counter array incremented by instrumented code. The reports read
+ * the array itself, getArray(), after emitMerge.
+ *
+ * Plain increments race when threads share the array, and relaxed atomic
+ * increments (Atomic) are exact but bounce the cache lines of hot counters
+ * between cores. With Shards, each thread increments its own copy instead:
+ * the entry of an instrumented function loads the thread's shard from a
+ * thread-local pointer, and the first one to run on a thread claims a free
+ * shard of the list of all the shards, or allocates and pushes a new one.
+ * When the thread exits, a destructor registered with glibc's
+ * __cxa_thread_atexit_impl moves the counts of its shard into the array
+ * with atomic adds and marks the shard free for the next thread, so the
+ * list only grows with the threads alive at once.
+ * emitMerge moves the shards of the threads still running the same way.
+ */
+class ProfileCounters {
+public:
+  ProfileCounters(Module & M, unsigned N, const Twine & Name, CounterSharing Sharing)
+      : Sharing(Sharing), N(N) {
+    auto &CTX = M.getContext();
+    auto *i64 = Type::getInt64Ty(CTX);
+    Array = createArray(M, i64, N, Name);
+    if (Sharing != CounterSharing::Shards)
+      return;
+
+    // a shard is {next, owned, counts, padding}: the list is linked through
+    // integers so that it can be updated with atomicrmw, and the padding
+    // keeps the counts of two shards off a common cache line
+    auto &DL = M.getDataLayout();
+    auto *intPtr = DL.getIntPtrType(CTX);
+    auto *i32 = Type::getInt32Ty(CTX);
+    auto *i8Ptr = Type::getInt8PtrTy(CTX);
+    ShardType = StructType::get(intPtr, i32, ArrayType::get(i64, N), ArrayType::get(Type::getInt8Ty(CTX), 64));
+    auto *shardPtr = ShardType->getPointerTo();
+    Current = new GlobalVariable(M, shardPtr, false, GlobalVariable::InternalLinkage,
+                                 ConstantPointerNull::get(shardPtr), Name + ".shard", nullptr,
+                                 GlobalVariable::GeneralDynamicTLSModel);
+    Shards = new GlobalVariable(M, intPtr, false, GlobalVariable::InternalLinkage,
+                                ConstantInt::get(intPtr, 0), Name + ".shards");
+    LinkAlign = DL.getTypeStoreSize(intPtr);
+    Shards->setAlignment(LinkAlign);
+
+    // thread exit: move the counts to the array, free the shard and forget it
+    Release = Function::Create(FunctionType::get(Type::getVoidTy(CTX), {i8Ptr}, false),
+                               GlobalValue::InternalLinkage, Name + ".release", &M);
+    IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", Release));
+    auto *released = Builder.CreateBitCast(&*Release->arg_begin(), shardPtr);
+    emitMove(Builder, released);
+    Builder.CreateStore(ConstantPointerNull::get(shardPtr), Current);
+    Builder.CreateAtomicRMW(AtomicRMWInst::Xchg, Builder.CreateStructGEP(ShardType, released, 1), Builder.getInt32(0), AtomicOrdering::Release);
+    Builder.CreateRetVoid();
+
+    // `void* calloc(size_t, size_t)`
+    auto callocFunc = M.getOrInsertFunction("calloc", FunctionType::get(
+      i8Ptr, {intPtr, intPtr}, false));
+    // `int __cxa_thread_atexit_impl(void (*)(void*), void*, void*)`, of glibc
+    // itself, as C programs do not link the C++ runtime's __cxa_thread_atexit
+    auto atexitFunc = M.getOrInsertFunction("__cxa_thread_atexit_impl", FunctionType::get(
+      i32, {Release->getType(), i8Ptr, i8Ptr}, false));
+    auto *dsoHandle = M.getOrInsertGlobal("__dso_handle", Type::getInt8Ty(CTX));
+    if (auto *handle = dyn_cast<GlobalVariable>(dsoHandle))
+      handle->setVisibility(GlobalValue::HiddenVisibility);
+
+    Register = Function::Create(FunctionType::get(shardPtr, false),
+                                GlobalValue::InternalLinkage, Name + ".register", &M);
+    auto *entry = BasicBlock::Create(CTX, "entry", Register);
+    auto *head = BasicBlock::Create(CTX, "free", Register);
+    auto *body = BasicBlock::Create(CTX, "free.body", Register);
+    auto *allocate = BasicBlock::Create(CTX, "allocate", Register);
+    auto *push = BasicBlock::Create(CTX, "push", Register);
+    auto *done = BasicBlock::Create(CTX, "done", Register);
+    Builder.SetInsertPoint(entry);
+    auto *first = emitLoadLink(Builder, Shards);
+    Builder.CreateBr(head);
+
+    // claim the first free shard
+    Builder.SetInsertPoint(head);
+    auto *address = Builder.CreatePHI(intPtr, 2);
+    address->addIncoming(first, entry);
+    Builder.CreateCondBr(Builder.CreateIsNull(address), allocate, body);
+    Builder.SetInsertPoint(body);
+    auto *candidate = Builder.CreateIntToPtr(address, shardPtr);
+    auto *claim = Builder.CreateAtomicCmpXchg(Builder.CreateStructGEP(ShardType, candidate, 1), Builder.getInt32(0), Builder.getInt32(1), AtomicOrdering::Acquire, AtomicOrdering::Monotonic);
+    address->addIncoming(emitLoadLink(Builder, Builder.CreateStructGEP(ShardType, candidate, 0)), body);
+    Builder.CreateCondBr(Builder.CreateExtractValue(claim, 1), done, head);
+
+    // or push a new one, linked before it is published
+    Builder.SetInsertPoint(allocate);
+    auto *memory = Builder.CreateCall(callocFunc, {ConstantInt::get(intPtr, 1),
+                                                   ConstantInt::get(intPtr, DL.getTypeAllocSize(ShardType))});
+    auto *fresh = Builder.CreateBitCast(memory, shardPtr);
+    Builder.CreateStore(Builder.getInt32(1), Builder.CreateStructGEP(ShardType, fresh, 1));
+    Builder.CreateBr(push);
+    Builder.SetInsertPoint(push);
+    auto *next = emitLoadLink(Builder, Shards);
+    Builder.CreateAlignedStore(next, Builder.CreateStructGEP(ShardType, fresh, 0), LinkAlign)
+        ->setAtomic(AtomicOrdering::Release);
+    auto *pushed = Builder.CreateAtomicCmpXchg(Shards, next, Builder.CreatePtrToInt(fresh, intPtr), AtomicOrdering::AcquireRelease, AtomicOrdering::Acquire);
+    Builder.CreateCondBr(Builder.CreateExtractValue(pushed, 1), done, push);
+
+    Builder.SetInsertPoint(done);
+    auto *shard = Builder.CreatePHI(shardPtr, 2);
+    shard->addIncoming(candidate, body);
+    shard->addIncoming(fresh, push);
+    Builder.CreateStore(shard, Current);
+    Builder.CreateCall(atexitFunc, {Release, Builder.CreateBitCast(shard, i8Ptr), dsoHandle});
+    Builder.CreateRet(shard);
+  }
+
+  GlobalVariable * getArray() const { return Array; }
+
+  // Whether F is code of the counters, which must not be instrumented
+  bool isHelper(const Function & F) const { return &F == Register || &F == Release; }
+
+  // Counter[I] += 1, inline
+  void emitIncrement(IRBuilder<> & Builder, Value * I) {
+    switch (Sharing) {
+    case CounterSharing::Plain:
+      llvm::emitIncrement(Builder, Array, I);
+      break;
+    case CounterSharing::Atomic:
+      Builder.CreateAtomicRMW(AtomicRMWInst::Add, emitElement(Builder, Array, I), Builder.getInt64(1), AtomicOrdering::Monotonic);
+      break;
+    case CounterSharing::Shards: {
+      auto *shard = getShard(*Builder.GetInsertBlock()->getParent());
+      auto *counter = Builder.CreateInBoundsGEP(ShardType, shard, {Builder.getInt32(0), Builder.getInt32(2), I});
+      auto *count = Builder.CreateLoad(Builder.getInt64Ty(), counter);
+      Builder.CreateStore(Builder.CreateAdd(count, Builder.getInt64(1)), counter);
+      break;
+    }
+    }
+  }
+
+  void emitIncrement(IRBuilder<> & Builder, unsigned I) {
+    emitIncrement(Builder, Builder.getInt32(I));
+  }
+
+  /*
+   * Load the shard in the functions instrumented with Shards, once all their
+   * increments are emitted: a new entry block calls Register when the
+   * thread has none yet. The static allocas move to that block to stay
+   * static.
+   */
+  void finishFunction(Function & F) {
+    auto it = FunctionShard.find(&F);
+    if (it == FunctionShard.end())
+      return;
+    auto *phi = it->second;
+    FunctionShard.erase(it);
+    auto *oldEntry = &F.getEntryBlock();
+    auto *entry = BasicBlock::Create(F.getContext(), "shard.entry", &F, oldEntry);
+    auto *registerBlock = BasicBlock::Create(F.getContext(), "shard.register", &F, oldEntry);
+    std::vector<AllocaInst *> allocas;
+    for (auto &I: *oldEntry) {
+      auto *alloca = dyn_cast<AllocaInst>(&I);
+      if (alloca && isa<Constant>(alloca->getArraySize()))
+        allocas.push_back(alloca);
+    }
+    for (auto *alloca: allocas) {
+      alloca->moveBefore(*entry, entry->end());
+    }
+
+    IRBuilder<> Builder(entry);
+    auto *shard = Builder.CreateLoad(phi->getType(), Current);
+    Builder.CreateCondBr(Builder.CreateIsNull(shard), registerBlock, oldEntry);
+    phi->addIncoming(shard, entry);
+    Builder.SetInsertPoint(registerBlock);
+    phi->addIncoming(Builder.CreateCall(Register), registerBlock);
+    Builder.CreateBr(oldEntry);
+  }
+
+  /*
+   * Move the counts of all the shards into the array, so that reporting
+   * again only adds the new counts. A thread that still runs may lose the
+   * increments racing with the move of its counter.
+   */
+  void emitMerge(IRBuilder<> & Builder) {
+    if (Sharing != CounterSharing::Shards)
+      return;
+    auto *F = Builder.GetInsertBlock()->getParent();
+    auto &CTX = F->getContext();
+    auto *intPtr = Shards->getValueType();
+    auto *pre = Builder.GetInsertBlock();
+    auto *head = BasicBlock::Create(CTX, "shards", F);
+    auto *body = BasicBlock::Create(CTX, "shards.body", F);
+    auto *exit = BasicBlock::Create(CTX, "shards.end", F);
+    auto *first = emitLoadLink(Builder, Shards);
+    Builder.CreateBr(head);
+
+    Builder.SetInsertPoint(head);
+    auto *address = Builder.CreatePHI(intPtr, 2);
+    address->addIncoming(first, pre);
+    Builder.CreateCondBr(Builder.CreateIsNull(address), exit, body);
+
+    Builder.SetInsertPoint(body);
+    auto *shard = Builder.CreateIntToPtr(address, ShardType->getPointerTo());
+    emitMove(Builder, shard);
+    auto *next = emitLoadLink(Builder, Builder.CreateStructGEP(ShardType, shard, 0));
+    address->addIncoming(next, Builder.GetInsertBlock());
+    Builder.CreateBr(head);
+    Builder.SetInsertPoint(exit);
+  }
+
+private:
+  // Load the head of the shard list or the next link of a shard, which other threads may push to
+  LoadInst * emitLoadLink(IRBuilder<> & Builder, Value * Link) {
+    auto *load = Builder.CreateAlignedLoad(Shards->getValueType(), Link, LinkAlign);
+    load->setAtomic(AtomicOrdering::Acquire);
+    return load;
+  }
+
+  // Move the counts of Shard into the array, atomically as Release may run concurrently
+  void emitMove(IRBuilder<> & Builder, Value * Shard) {
+    emitLoop(Builder, Builder.getInt32(0), Builder.getInt32(N), [&](Value *i) {
+      auto *counter = Builder.CreateInBoundsGEP(ShardType, Shard, {Builder.getInt32(0), Builder.getInt32(2), i});
+      auto *count = Builder.CreateAtomicRMW(AtomicRMWInst::Xchg, counter, Builder.getInt64(0), AtomicOrdering::Monotonic);
+      Builder.CreateAtomicRMW(AtomicRMWInst::Add, emitElement(Builder, Array, i), count, AtomicOrdering::Monotonic);
+    });
+  }
+
+  // The shard of the thread in F, a Phi finishFunction completes
+  Value * getShard(Function & F) {
+    auto &phi = FunctionShard[&F];
+    if (phi == nullptr)
+      phi = PHINode::Create(ShardType->getPointerTo(), 2, "shard", &*F.getEntryBlock().begin());
+    return phi;
+  }
+
+  CounterSharing Sharing;
+  unsigned N;
+  GlobalVariable *Array;
+  // Shards only
+  StructType *ShardType = nullptr;
+  GlobalVariable *Current = nullptr, *Shards = nullptr;
+  Function *Register = nullptr, *Release = nullptr;
+  unsigned LinkAlign = 0;
+  std::map<Function *, PHINode *> FunctionShard;
+};
+
+// An internal constant array of pointers to the strings, equal ones shared
+inline GlobalVariable * createStringTable(Module & M, ArrayRef<std::string> Strings, const Twine & Name) {
+  auto &CTX = M.getContext();
+  auto *i8Ptr = Type::getInt8PtrTy(CTX);
+  std::map<std::string, Constant *> pointers;
+  std::vector<Constant *> elements;
+  for (auto &str: Strings) {
+    auto &pointer = pointers[str];
+    if (pointer == nullptr) {
+      auto *init = ConstantDataArray::getString(CTX, str);
+      auto *global = new GlobalVariable(M, init->getType(), true, GlobalVariable::PrivateLinkage,
+                                        init, Name + ".str");
+      global->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+      pointer = ConstantExpr::getPointerCast(global, i8Ptr);
+    }
+    elements.push_back(pointer);
+  }
+  auto *type = ArrayType::get(i8Ptr, elements.size());
+  return new GlobalVariable(M, type, true, GlobalVariable::InternalLinkage,
+                            ConstantArray::get(type, elements), Name);
+}
+
+/*
+ * Report when the program ends, by returning from main or calling exit: a
+ * module constructor registers Prefix.exit with atexit, which calls Flush,
+ * the report of this module, if any, and then Print, the report of the
+ * runtime. Each instrumented module that links the same runtime adds itself
+ * to a linkonce_odr counter named after Print, which the linker merges, and
+ * only the last module to flush calls Print, so the runtime prints once with
+ * the counts of all modules. The constructor has the default priority, so
+ * it registers after the runtime linked before the module has constructed
+ * its globals, and reports before their destructors run. An abort is not
+ * reported: a SIGABRT handler could only run async-signal-safe code, which
+ * neither report is. Returns the functions it adds, which must not be
+ * instrumented.
+ */
+inline SmallVector<Function *, 2> reportAtExit(Module & M, Function * Flush, FunctionCallee Print,
+                                               const Twine & Prefix) {
+  auto &CTX = M.getContext();
+  auto *i32 = Type::getInt32Ty(CTX);
+  auto *voidType = Type::getVoidTy(CTX);
+  auto *exitType = FunctionType::get(voidType, false);
+  // `int atexit(void (*)(void))`
+  auto atexitFunc = M.getOrInsertFunction("atexit", FunctionType::get(i32, {exitType->getPointerTo()}, false));
+
+  GlobalVariable *modules = nullptr;
+  if (Print) {
+    auto name = "cse231.modules." + Print.getCallee()->getName().str();
+    modules = M.getNamedGlobal(name);
+    if (modules == nullptr)
+      modules = new GlobalVariable(M, i32, false, GlobalValue::LinkOnceODRLinkage,
+                                   ConstantInt::get(i32, 0), name);
+  }
+
+  auto *exit = Function::Create(exitType, GlobalValue::InternalLinkage, Prefix + ".exit", &M);
+  IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", exit));
+  if (Flush)
+    Builder.CreateCall(Flush);
+  if (modules) {
+    auto *print = BasicBlock::Create(CTX, "print", exit);
+    auto *done = BasicBlock::Create(CTX, "done", exit);
+    auto *left = Builder.CreateSub(Builder.CreateLoad(i32, modules), Builder.getInt32(1));
+    Builder.CreateStore(left, modules);
+    Builder.CreateCondBr(Builder.CreateICmpEQ(left, Builder.getInt32(0)), print, done);
+    Builder.SetInsertPoint(print);
+    Builder.CreateCall(Print);
+    Builder.CreateBr(done);
+    Builder.SetInsertPoint(done);
+  }
+  Builder.CreateRetVoid();
+
+  auto *ctor = Function::Create(exitType, GlobalValue::InternalLinkage, Prefix + ".ctor", &M);
+  Builder.SetInsertPoint(BasicBlock::Create(CTX, "entry", ctor));
+  if (modules)
+    Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(i32, modules), Builder.getInt32(1)), modules);
+  Builder.CreateCall(atexitFunc, {exit});
+  Builder.CreateRetVoid();
+  appendToGlobalCtors(M, ctor, 65535);
+  return {exit, ctor};
+}
+
+// The label of a block in reports: its name, or its position in the function
+inline std::string getBlockLabel(const BasicBlock & BB, unsigned Index) {
+  return BB.hasName() ? BB.getName().str() : "bb" + std::to_string(Index);
+}
+
+/*
+ * The static opcode histograms of a list of blocks, as constant tables: the
+ * histogram of block b is (Slot[k], Count[k]) for k in [Begin[b], Begin[b + 1]),
+ * a slot standing for one opcode of the module.
+ */
+class OpcodeHistograms {
+public:
+  OpcodeHistograms(Module & M, ArrayRef<BasicBlock *> Blocks, const Twine & Prefix) {
+    std::map<unsigned, unsigned> slots;
+    std::vector<std::map<unsigned, unsigned>> histograms;
+    for (auto *BB: Blocks) {
+      histograms.emplace_back();
+      for (auto &I: *BB) {
+        histograms.back()[I.getOpcode()]++;
+        slots[I.getOpcode()] = 0;
+      }
+    }
+
+    std::vector<unsigned> keys, begin, slot, count;
+    for (auto &kv: slots) {
+      kv.second = keys.size();
+      keys.push_back(kv.first);
+    }
+    for (auto &histogram: histograms) {
+      begin.push_back(slot.size());
+      for (auto &kv: histogram) {
+        slot.push_back(slots[kv.first]);
+        count.push_back(kv.second);
+      }
+    }
+    begin.push_back(slot.size());
+
+    NumBlocks = Blocks.size();
+    NumSlots = keys.size();
+    Keys = createTable(M, keys, Prefix + ".keys");
+    Begin = createTable(M, begin, Prefix + ".begin");
+    Slot = createTable(M, slot, Prefix + ".slot");
+    Count = createTable(M, count, Prefix + ".count");
+    auto *i32 = Type::getInt32Ty(M.getContext());
+    Totals = createArray(M, Type::getInt64Ty(M.getContext()), NumSlots, Prefix + ".totals");
+    ReportKeys = createArray(M, i32, NumSlots, Prefix + ".report");
+    ReportValues = createArray(M, i32, NumSlots, Prefix + ".report.values");
+  }
+
+  /*
+   * Multiply the execution count of each block, Counts[Offset + b], with its
+   * histogram into the i64 opcode totals and clear it. The nonzero totals are
+   * then passed to updateInstrInfo, as the runtime only expects the opcodes
+   * that executed, in rounds of at most UINT32_MAX per opcode until they are
+   * all zero again.
+   */
+  void emitFold(IRBuilder<> & Builder, GlobalVariable * Counts, unsigned Offset) {
+    auto &M = *Builder.GetInsertBlock()->getModule();
+    auto &CTX = M.getContext();
+    auto *i32 = Builder.getInt32Ty();
+    auto *i64 = Builder.getInt64Ty();
+    auto *countType = cast<ArrayType>(Counts->getValueType())->getElementType();
+    auto *zero = Builder.getInt32(0);
+
+    // totals[Slot[k]] += counts[Offset + b] * Count[k]
+    emitLoop(Builder, zero, Builder.getInt32(NumBlocks), [&](Value *b) {
+      auto *block = Builder.CreateAdd(b, Builder.getInt32(Offset));
+      auto *n = Builder.CreateZExtOrTrunc(emitLoad(Builder, Counts, block), i64);
+      Builder.CreateStore(ConstantInt::get(countType, 0), emitElement(Builder, Counts, block));
+      auto *end = emitLoad(Builder, Begin, Builder.CreateAdd(b, Builder.getInt32(1)));
+      emitLoop(Builder, emitLoad(Builder, Begin, b), end, [&](Value *k) {
+        auto *s = emitLoad(Builder, Slot, k);
+        auto *count = Builder.CreateZExt(emitLoad(Builder, Count, k), i64);
+        auto *total = Builder.CreateAdd(emitLoad(Builder, Totals, s), Builder.CreateMul(n, count));
+        Builder.CreateStore(total, emitElement(Builder, Totals, s));
+      });
+    });
+
+    // each round moves up to UINT32_MAX of every nonzero total to the front
+    auto *F = Builder.GetInsertBlock()->getParent();
+    auto *round = BasicBlock::Create(CTX, "report", F);
+    auto *update = BasicBlock::Create(CTX, "report.update", F);
+    auto *done = BasicBlock::Create(CTX, "report.end", F);
+    auto *entry = &F->getEntryBlock();
+    auto *numReported = IRBuilder<>(entry, entry->getFirstInsertionPt()).CreateAlloca(i32);
+    Builder.CreateBr(round);
+    Builder.SetInsertPoint(round);
+    Builder.CreateStore(zero, numReported);
+    auto *max = Builder.getInt64(UINT32_MAX);
+    emitLoop(Builder, zero, Builder.getInt32(NumSlots), [&](Value *s) {
+      auto *total = emitLoad(Builder, Totals, s);
+      auto *piece = Builder.CreateSelect(Builder.CreateICmpULT(total, max), total, max);
+      Builder.CreateStore(Builder.CreateSub(total, piece), emitElement(Builder, Totals, s));
+      auto *n = Builder.CreateLoad(i32, numReported);
+      Builder.CreateStore(emitLoad(Builder, Keys, s), emitElement(Builder, ReportKeys, n));
+      Builder.CreateStore(Builder.CreateTrunc(piece, i32), emitElement(Builder, ReportValues, n));
+      auto *nonzero = Builder.CreateZExt(Builder.CreateICmpNE(piece, Builder.getInt64(0)), i32);
+      Builder.CreateStore(Builder.CreateAdd(n, nonzero), numReported);
+    });
+    auto *n = Builder.CreateLoad(i32, numReported);
+    Builder.CreateCondBr(Builder.CreateICmpNE(n, zero), update, done);
+
+    // `void updateInstrInfo(unsigned, uint32_t*, uint32_t*)`
+    Builder.SetInsertPoint(update);
+    auto *i32Ptr = Type::getInt32PtrTy(CTX);
+    auto updateFunc = M.getOrInsertFunction("updateInstrInfo", FunctionType::get(
+      Type::getVoidTy(CTX), {i32, i32Ptr, i32Ptr}, false));
+    Builder.CreateCall(updateFunc, {n,
+                                    Builder.CreatePointerCast(ReportKeys, i32Ptr),
+                                    Builder.CreatePointerCast(ReportValues, i32Ptr)});
+    Builder.CreateBr(round);
+    Builder.SetInsertPoint(done);
+  }
+
+private:
+  unsigned NumBlocks, NumSlots;
+  GlobalVariable *Keys, *Begin, *Slot, *Count;
+  GlobalVariable *Totals, *ReportKeys, *ReportValues;
+};
+
+/*
+ * The branch sites of a module, reported one per line on stderr as
+ * `site function block location taken not-taken`. A conditional branch is
+ * one site, taken when it goes to its first successor; a switch has a site
+ * per case and one for the default, labelled `block:case N` and
+ * `block:default`. The location is file:line when the branch has debug
+ * information, and - otherwise.
+ */
+class BranchSites {
+public:
+  /*
+   * Add the sites of Terminator, in the Index-th block of its function, if
+   * it is a conditional branch or a switch; Counts[Base + i] must count how
+   * often it goes to its i-th successor.
+   */
+  bool addSites(Instruction * Terminator, unsigned Index, unsigned Base) {
+    auto label = getBlockLabel(*Terminator->getParent(), Index);
+    unsigned end = Base + Terminator->getNumSuccessors();
+    if (auto *branch = dyn_cast<BranchInst>(Terminator)) {
+      if (!branch->isConditional())
+        return false;
+      addSite(Terminator, label, Base, Base, end);
+      return true;
+    }
+    auto *sw = dyn_cast<SwitchInst>(Terminator);
+    if (sw == nullptr)
+      return false;
+    for (auto &c: sw->cases()) {
+      addSite(Terminator, label + ":case " + std::to_string(c.getCaseValue()->getSExtValue()),
+              Base + c.getSuccessorIndex(), Base, end);
+    }
+    addSite(Terminator, label + ":default", Base, Base, end);
+    return true;
+  }
+
+  size_t size() const { return Functions.size(); }
+
+  // Print the table, looping over constant tables of the sites
+  void emitReport(IRBuilder<> & Builder, GlobalVariable * Counts, const Twine & Prefix) {
+    if (Functions.empty())
+      return;
+    auto &M = *Builder.GetInsertBlock()->getModule();
+    auto &CTX = M.getContext();
+    auto *i32 = Builder.getInt32Ty();
+    auto *countType = cast<ArrayType>(Counts->getValueType())->getElementType();
+    auto *functions = createStringTable(M, Functions, Prefix + ".functions");
+    auto *blocks = createStringTable(M, Blocks, Prefix + ".blocks");
+    auto *locations = createStringTable(M, Locations, Prefix + ".locations");
+    auto *taken = createTable(M, TakenCounts, Prefix + ".taken");
+    auto *ranges = createTable(M, Ranges, Prefix + ".ranges");
+
+    // `int dprintf(int, const char*, ...)`, to stderr as the runtime
+    auto *i8Ptr = Type::getInt8PtrTy(CTX);
+    auto reportFunc = M.getOrInsertFunction("dprintf", FunctionType::get(i32, {i32, i8Ptr}, true));
+    auto *format = Builder.CreateGlobalStringPtr("%u\t%s\t%s\t%s\t%llu\t%llu\n", Prefix + ".format");
+    auto *entry = &Builder.GetInsertBlock()->getParent()->getEntryBlock();
+    auto *sum = IRBuilder<>(entry, entry->getFirstInsertionPt()).CreateAlloca(countType);
+
+    emitLoop(Builder, Builder.getInt32(0), Builder.getInt32(Functions.size()), [&](Value *s) {
+      auto *first = Builder.CreateMul(s, Builder.getInt32(2));
+      auto *begin = emitLoad(Builder, ranges, first);
+      auto *end = emitLoad(Builder, ranges, Builder.CreateAdd(first, Builder.getInt32(1)));
+      Builder.CreateStore(ConstantInt::get(countType, 0), sum);
+      emitLoop(Builder, begin, end, [&](Value *k) {
+        Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(countType, sum),
+                                              emitLoad(Builder, Counts, k)), sum);
+      });
+      auto *count = emitLoad(Builder, Counts, emitLoad(Builder, taken, s));
+      Builder.CreateCall(reportFunc, {Builder.getInt32(2), format, s,
+                                      emitLoad(Builder, functions, s), emitLoad(Builder, blocks, s),
+                                      emitLoad(Builder, locations, s), count,
+                                      Builder.CreateSub(Builder.CreateLoad(countType, sum), count)});
+    });
+  }
+
+private:
+  // The taken count of a site is Counts[Taken], the not-taken count the sum
+  // of Counts[Begin .. End), all the outcomes of the branch, minus it
+  void addSite(Instruction * Branch, const std::string & Block, unsigned Taken,
+               unsigned Begin, unsigned End) {
+    Functions.push_back(Branch->getFunction()->getName().str());
+    Blocks.push_back(Block);
+    std::string location = "-";
+    if (auto &DL = Branch->getDebugLoc()) {
+      auto *scope = cast<DIScope>(DL.getScope());
+      location = scope->getFilename().str() + ":" + std::to_string(DL.getLine());
+    }
+    Locations.push_back(location);
+    TakenCounts.push_back(Taken);
+    Ranges.push_back(Begin);
+    Ranges.push_back(End);
+  }
+
+  std::vector<std::string> Functions, Blocks, Locations;
+  std::vector<unsigned> TakenCounts, Ranges;
+};
+
+}
+#endif // End LLVM_TRANSFORMS_231PROFILE_H
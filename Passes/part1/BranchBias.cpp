@@ -11,26 +11,57 @@
  */
 
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IRBuilder.h"
+
+#include "../DFA/231Profile.h"
 using namespace llvm;
 
+#include <memory>
+
 namespace {
+cl::opt<bool> Sites("cse231-bb-sites",
+    cl::desc("Count the outcomes of each branch site inline and print a "
+             "per-site table when the program exits"));
+cl::opt<CounterSharing> Sharing("cse231-bb-sharing",
+    cl::desc("How threads share the counters of -cse231-bb-sites"),
+    counterSharingValues(), cl::init(CounterSharing::Shards));
+
 struct BranchBiasProfiler: public FunctionPass {
   static char ID;
   BranchBiasProfiler() : FunctionPass(ID) {}
 
+  bool doInitialization(Module &M) override {
+    if (Sites) {
+      createSites(M);
+      return true;
+    }
+    auto &CTX = M.getContext();
+    // `void printOutBranchInfo()`
+    auto printFunc = M.getOrInsertFunction("printOutBranchInfo", FunctionType::get(
+      Type::getVoidTy(CTX), false));
+    for (auto helper: reportAtExit(M, nullptr, printFunc, "cse231.bb")) {
+      Helpers.insert(helper);
+    }
+    return true;
+  }
+
   bool runOnFunction(Function &F) override {
+    if (Helpers.count(&F))
+      return false;
+    if (Sites)
+      return instrumentSites(F);
+
     bool modified = false;
     auto M = F.getParent();
     auto &CTX = M->getContext();
     // `void updateBranchInfo(bool taken)`
     auto updateFunc = M->getOrInsertFunction("updateBranchInfo", FunctionType::get(
       Type::getVoidTy(CTX), {Type::getInt1Ty(CTX)}, false));
-    // `void printOutBranchInfo()`
-    auto printFunc = M->getOrInsertFunction("printOutBranchInfo", FunctionType::get(
-      Type::getVoidTy(CTX), false));
 
     IRBuilder<> Builder(CTX);
     for (auto &BB: F) {
@@ -41,14 +72,91 @@ struct BranchBiasProfiler: public FunctionPass {
         Builder.CreateCall(updateFunc, {cast<BranchInst>(terminator)->getCondition()});
         modified = true;
       }
-      if (isa<ReturnInst>(terminator)) {
-        Builder.SetInsertPoint(terminator);
-        Builder.CreateCall(printFunc);
-        modified = true;
+    }
+    return modified;
+  }
+
+private:
+  /*
+   * Site mode: each conditional branch and switch gets a counter per
+   * successor in cse231.bb.counts, at SiteBase, and cse231.bb.report prints
+   * the table of the sites (see BranchSites) when the program exits.
+   * Threads share the counters as -cse231-bb-sharing says.
+   */
+  void createSites(Module &M) {
+    auto &CTX = M.getContext();
+    BranchSites sites;
+    unsigned numCounters = 0;
+    for (auto &F: M) {
+      unsigned b = 0;
+      for (auto &BB: F) {
+        auto terminator = BB.getTerminator();
+        if (sites.addSites(terminator, b++, numCounters)) {
+          SiteBase[terminator] = numCounters;
+          numCounters += terminator->getNumSuccessors();
+        }
+      }
+    }
+    Counts.reset(new ProfileCounters(M, numCounters, "cse231.bb.counts", Sharing));
+
+    auto report = Function::Create(FunctionType::get(Type::getVoidTy(CTX), false),
+                                   GlobalValue::InternalLinkage, "cse231.bb.report", &M);
+    IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", report));
+    Counts->emitMerge(Builder);
+    sites.emitReport(Builder, Counts->getArray(), "cse231.bb.sites");
+    Builder.CreateRetVoid();
+    Helpers.insert(report);
+    for (auto helper: reportAtExit(M, report, FunctionCallee(), "cse231.bb")) {
+      Helpers.insert(helper);
+    }
+  }
+
+  /*
+   * A conditional branch adds its negated condition to its first counter, so
+   * both outcomes share one increment. A switch counts on its edges, each in
+   * a new block that one Phi entry of the switch block moves to.
+   */
+  bool instrumentSites(Function &F) {
+    if (Counts->isHelper(F))
+      return false;
+    bool modified = false;
+    std::vector<BasicBlock*> blocks;
+    for (auto &BB: F) {
+      blocks.push_back(&BB);
+    }
+    for (auto BB: blocks) {
+      auto terminator = BB->getTerminator();
+      auto it = SiteBase.find(terminator);
+      if (it == SiteBase.end())
+        continue;
+      modified = true;
+      if (auto branch = dyn_cast<BranchInst>(terminator)) {
+        IRBuilder<> Builder(terminator);
+        auto notTaken = Builder.CreateZExt(Builder.CreateNot(branch->getCondition()), Builder.getInt32Ty());
+        Counts->emitIncrement(Builder, Builder.CreateAdd(Builder.getInt32(it->second), notTaken));
+        continue;
+      }
+      for (unsigned i = 0; i < terminator->getNumSuccessors(); ++i) {
+        auto dst = terminator->getSuccessor(i);
+        auto edge = BasicBlock::Create(F.getContext(), "case", &F, dst);
+        IRBuilder<> Builder(edge);
+        Counts->emitIncrement(Builder, it->second + i);
+        Builder.CreateBr(dst);
+        terminator->setSuccessor(i, edge);
+        for (auto &phi: dst->phis()) {
+          phi.setIncomingBlock(phi.getBasicBlockIndex(BB), edge);
+        }
       }
     }
+    Counts->finishFunction(F);
     return modified;
   }
+
+  // the functions added to report, not instrumented
+  SmallPtrSet<Function*, 4> Helpers;
+  // Site mode only
+  DenseMap<Instruction*, unsigned> SiteBase;
+  std::unique_ptr<ProfileCounters> Counts;
 };
 } // namespace
 
@@ -3,37 +3,66 @@
  * each instruction will be counted according to the taken branches 
  * and the associated statistics gathered statically.
  * 
- * Before the instrumented function returned, print out the infomation.
+ * When the program exits, print out the infomation once.
  */
 
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IRBuilder.h"
 
+#include "../DFA/231Profile.h"
+
 using namespace llvm;
 
 #include <map>
+#include <memory>
 #include <vector>
 
 namespace {
+cl::opt<bool> Counters("cse231-cdi-counters",
+    cl::desc("Count block executions in a module counter array, "
+             "folded into the opcode totals only when reporting"));
+cl::opt<CounterSharing> Sharing("cse231-cdi-sharing",
+    cl::desc("How threads share the counters of -cse231-cdi-counters"),
+    counterSharingValues(), cl::init(CounterSharing::Shards));
+
 struct DynamicInstCounter: public FunctionPass {
   static char ID;
   DynamicInstCounter() : FunctionPass(ID) {}
 
+  bool doInitialization(Module &M) override {
+    if (Counters) {
+      createCounters(M);
+      return true;
+    }
+    auto &CTX = M.getContext();
+    // `void printOutInstrInfo()`
+    auto printFunc = M.getOrInsertFunction("printOutInstrInfo", FunctionType::get(
+      Type::getVoidTy(CTX), false));
+    for (auto helper: reportAtExit(M, nullptr, printFunc, "cse231.cdi")) {
+      Helpers.insert(helper);
+    }
+    return true;
+  }
+
   bool runOnFunction(Function &F) override {
+    if (Helpers.count(&F))
+      return false;
+    if (Counters)
+      return instrumentCounters(F);
+
     auto M = F.getParent();
     auto &CTX = M->getContext();
     // `void updateInstrInfo(unsigned, uint32_t*, uint32_t*)`
-    auto i32Ptr = Type::getInt32Ty(CTX);
+    auto i32Ptr = Type::getInt32PtrTy(CTX);
     auto updateFunc = M->getOrInsertFunction("updateInstrInfo", FunctionType::get(
       Type::getVoidTy(CTX), {Type::getInt32Ty(CTX), i32Ptr, i32Ptr}, false));
-    // `void printOutInstrInfo()`
-    auto printFunc = M->getOrInsertFunction("printOutInstrInfo", FunctionType::get(
-      Type::getVoidTy(CTX), false));
 
     std::map<uint, uint> counter;
-    Instruction* ret = nullptr;
     for (auto &BB: F) {
       for (auto &I : BB) {
         auto code = I.getOpcode();
@@ -42,10 +71,6 @@ struct DynamicInstCounter: public FunctionPass {
         if (p.second == false) {
           p.first->second += 1;
         }
-        // is it a `ret` instruction?
-        if (isa<ReturnInst>(&I)) {
-          ret = &I;
-        }
       }
       // insert updateInstrInfo
       IRBuilder<> Builder{&*BB.getFirstInsertionPt()};
@@ -64,18 +89,69 @@ struct DynamicInstCounter: public FunctionPass {
         ConstantInt::get(Type::getInt32Ty(CTX), keys.size()), 
         Builder.CreatePointerCast(keys_global, i32Ptr),
         Builder.CreatePointerCast(values_global, i32Ptr)});
-
-      // insert printOutInstrInfo
-      if (ret != nullptr) {
-        Builder.SetInsertPoint(ret);
-        Builder.CreateCall(printFunc);
-        ret = nullptr;
-      }
       counter.clear();
     }
     // IR was modified
     return true;
   }
+
+private:
+  /*
+   * Counter mode: every block of the module gets an ID and a counter in
+   * cse231.cdi.counts, which the block increments inline. The opcode
+   * histograms of the blocks are kept in constant tables, and
+   * cse231.cdi.flush multiplies them with the counters into the opcode
+   * totals, passes those to updateInstrInfo and clears the counters, so
+   * the reports are the same as with a call per block. It runs once, when
+   * the program exits. Threads share the counters as -cse231-cdi-sharing
+   * says.
+   */
+  void createCounters(Module &M) {
+    auto &CTX = M.getContext();
+    std::vector<BasicBlock*> blocks;
+    for (auto &F: M) {
+      for (auto &BB: F) {
+        BlockID[&BB] = blocks.size();
+        blocks.push_back(&BB);
+      }
+    }
+    if (blocks.empty())
+      return;
+    OpcodeHistograms histograms(M, blocks, "cse231.cdi");
+    Counts.reset(new ProfileCounters(M, blocks.size(), "cse231.cdi.counts", Sharing));
+
+    // `void printOutInstrInfo()`
+    auto printFunc = M.getOrInsertFunction("printOutInstrInfo", FunctionType::get(
+      Type::getVoidTy(CTX), false));
+    auto flush = Function::Create(FunctionType::get(Type::getVoidTy(CTX), false),
+                                  GlobalValue::InternalLinkage, "cse231.cdi.flush", &M);
+    IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", flush));
+    Counts->emitMerge(Builder);
+    histograms.emitFold(Builder, Counts->getArray(), 0);
+    Builder.CreateRetVoid();
+    Helpers.insert(flush);
+    for (auto helper: reportAtExit(M, flush, printFunc, "cse231.cdi")) {
+      Helpers.insert(helper);
+    }
+  }
+
+  // Increment the counter of each block
+  bool instrumentCounters(Function &F) {
+    if (Counts == nullptr || Counts->isHelper(F))
+      return false;
+    for (auto &BB: F) {
+      IRBuilder<> Builder{&*BB.getFirstInsertionPt()};
+      Counts->emitIncrement(Builder, BlockID.lookup(&BB));
+    }
+    Counts->finishFunction(F);
+    return true;
+  }
+
+  // the functions added to report, not instrumented
+  SmallPtrSet<Function*, 4> Helpers;
+  // Counter mode only
+  DenseMap<BasicBlock*, unsigned> BlockID;
+  std::unique_ptr<ProfileCounters> Counts;
 };
 } // namespace
 
@@ -0,0 +1,354 @@
+/*
+ * Profile the edges of every CFG with counters on as few of them as possible
+ * (Ball and Larus, "Optimally profiling and tracing programs").
+ *
+ * The blocks of a function and a virtual exit node, with an edge from each
+ * return to the exit and one from the exit to the entry, form a graph in
+ * which the flow is conserved at every node. Only the edges outside a maximum
+ * spanning tree, weighted by the loop depth, get counters; the count of each
+ * tree edge follows from the counts around one of its ends. When the
+ * program exits, the tree edges and then the blocks are solved in that
+ * order, the dynamic instruction counts are reported through the runtime
+ * like cse231-cdi, and the branch sites as with cse231-bb -cse231-bb-sites.
+ * The flow is only conserved in the functions that have returned, so on
+ * exit, the counts of those still running are approximate.
+ */
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "../DFA/231Profile.h"
+
+using namespace llvm;
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+cl::opt<CounterSharing> Sharing("cse231-edges-sharing",
+    cl::desc("How threads share the edge counters"),
+    counterSharingValues(), cl::init(CounterSharing::Shards));
+
+/*
+ * An edge of the profiling graph of a function: Succ is the successor index
+ * of Dst in the terminator of Src, or ~0u for the virtual edges.
+ */
+struct ProfileEdge {
+  unsigned Src, Dst;
+  unsigned Succ;
+  uint64_t Weight;
+  bool InTree;
+};
+
+// counts[Target] = the sum of the counts of the Terms, those marked true subtracted
+struct SolveStep {
+  unsigned Target;
+  std::vector<std::pair<unsigned, bool>> Terms;
+};
+
+struct EdgeProfiler: public ModulePass {
+  static char ID;
+  EdgeProfiler(): ModulePass(ID) {}
+
+  bool runOnModule(Module &M) override {
+    // the counters of the edges of all functions, then one per block
+    std::vector<BasicBlock*> blocks;
+    std::vector<std::vector<ProfileEdge>> edges;
+    std::vector<unsigned> edgeBase;
+    unsigned numEdges = 0;
+    for (auto &F: M) {
+      if (F.isDeclaration())
+        continue;
+      edges.push_back(buildGraph(F));
+      edgeBase.push_back(numEdges);
+      numEdges += edges.back().size();
+      for (auto &BB: F) {
+        blocks.push_back(&BB);
+      }
+    }
+    if (blocks.empty())
+      return false;
+    Counters.reset(new ProfileCounters(M, numEdges + blocks.size(), "cse231.edges.counts", Sharing));
+    Counts = Counters->getArray();
+    // taken before the blocks get their counters
+    OpcodeHistograms histograms(M, blocks, "cse231.edges");
+
+    // the equations of the tree edges and the blocks of each function, and the branch sites
+    std::vector<SolveStep> steps;
+    unsigned f = 0, blockBase = numEdges;
+    for (auto &F: M) {
+      if (F.isDeclaration() || Counters->isHelper(F))
+        continue;
+      solveGraph(F, edges[f], edgeBase[f], blockBase, steps);
+      collectBranches(F, edges[f], edgeBase[f]);
+      blockBase += F.size();
+      instrument(F, edges[f], edgeBase[f]);
+      Counters->finishFunction(F);
+      f++;
+    }
+
+    // `void printOutInstrInfo()`
+    auto printFunc = M.getOrInsertFunction("printOutInstrInfo", FunctionType::get(
+      Type::getVoidTy(M.getContext()), false));
+    reportAtExit(M, createFlush(M, histograms, numEdges, steps), printFunc, "cse231.edges");
+    return true;
+  }
+
+private:
+  /*
+   * The edges of F, the virtual exit node having index F.size(). The exit
+   * to entry edge comes first and is the only one already in the tree.
+   */
+  std::vector<ProfileEdge> buildGraph(Function &F) {
+    DominatorTree DT(F);
+    LoopInfo LI(DT);
+    DenseMap<BasicBlock*, unsigned> index;
+    unsigned exit = 0;
+    for (auto &BB: F) {
+      index[&BB] = exit++;
+    }
+
+    std::vector<ProfileEdge> edges{{exit, 0, ~0u, 0, true}};
+    for (auto &BB: F) {
+      // a block nested in n loops is assumed to run 8^n times per call
+      uint64_t freq = uint64_t(1) << (3 * std::min(LI.getLoopDepth(&BB), 20u));
+      auto terminator = BB.getTerminator();
+      unsigned n = terminator->getNumSuccessors();
+      if (n == 0) {
+        edges.push_back({index[&BB], exit, ~0u, freq, false});
+      }
+      // an edge that instrument() could not count has to be in the tree
+      bool splittable = isa<BranchInst>(terminator) || isa<SwitchInst>(terminator);
+      for (unsigned i = 0; i < n; ++i) {
+        auto succ = terminator->getSuccessor(i);
+        uint64_t weight = n == 1 || splittable || succ->getSinglePredecessor() ? freq / n : UINT64_MAX;
+        edges.push_back({index[&BB], index[succ], i, weight, false});
+      }
+    }
+
+    // Kruskal: the heaviest edges that do not close a cycle
+    std::vector<unsigned> parent(exit + 1);
+    for (unsigned i = 0; i <= exit; ++i) {
+      parent[i] = i;
+    }
+    auto find = [&](unsigned n) {
+      while (parent[n] != n)
+        n = parent[n] = parent[parent[n]];
+      return n;
+    };
+    parent[find(edges[0].Src)] = find(edges[0].Dst);
+    std::vector<unsigned> order;
+    for (unsigned e = 1; e < edges.size(); ++e) {
+      order.push_back(e);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+      return edges[a].Weight > edges[b].Weight;
+    });
+    for (auto e: order) {
+      unsigned a = find(edges[e].Src), b = find(edges[e].Dst);
+      if (a != b) {
+        parent[a] = b;
+        edges[e].InTree = true;
+      }
+    }
+    return edges;
+  }
+
+  /*
+   * Peel the leaves of the spanning tree: at a node with a single unsolved
+   * tree edge, that edge is the difference of the other edges around it.
+   * The blocks are then the sum of their incoming edges.
+   */
+  void solveGraph(Function &F, const std::vector<ProfileEdge> &edges, unsigned edgeBase,
+                  unsigned blockBase, std::vector<SolveStep> &steps) {
+    unsigned numNodes = F.size() + 1;
+    std::vector<std::vector<unsigned>> incident(numNodes);
+    std::vector<unsigned> unsolved(numNodes, 0);
+    for (unsigned e = 0; e < edges.size(); ++e) {
+      incident[edges[e].Src].push_back(e);
+      if (edges[e].Dst != edges[e].Src)
+        incident[edges[e].Dst].push_back(e);
+      if (edges[e].InTree) {
+        unsolved[edges[e].Src]++;
+        unsolved[edges[e].Dst]++;
+      }
+    }
+
+    std::vector<bool> solved(edges.size());
+    for (unsigned e = 0; e < edges.size(); ++e) {
+      solved[e] = !edges[e].InTree;
+    }
+    std::deque<unsigned> leaves;
+    for (unsigned n = 0; n < numNodes; ++n) {
+      if (unsolved[n] == 1)
+        leaves.push_back(n);
+    }
+    while (!leaves.empty()) {
+      unsigned n = leaves.front();
+      leaves.pop_front();
+      if (unsolved[n] != 1)
+        continue;
+      auto it = std::find_if(incident[n].begin(), incident[n].end(),
+                             [&](unsigned e) { return !solved[e]; });
+      unsigned target = *it;
+      // the flow into n equals the flow out of it
+      bool targetIn = edges[target].Dst == n;
+      SolveStep step{edgeBase + target, {}};
+      for (auto e: incident[n]) {
+        if (e == target)
+          continue;
+        if (edges[e].Src == n)
+          step.Terms.push_back({edgeBase + e, !targetIn});
+        if (edges[e].Dst == n)
+          step.Terms.push_back({edgeBase + e, targetIn});
+      }
+      steps.push_back(std::move(step));
+      solved[target] = true;
+      for (auto m: {edges[target].Src, edges[target].Dst}) {
+        if (--unsolved[m] == 1)
+          leaves.push_back(m);
+      }
+    }
+
+    for (unsigned b = 0; b < F.size(); ++b) {
+      SolveStep step{blockBase + b, {}};
+      for (auto e: incident[b]) {
+        if (edges[e].Dst == b)
+          step.Terms.push_back({edgeBase + e, false});
+      }
+      steps.push_back(std::move(step));
+    }
+  }
+
+  /*
+   * Add a counter to each edge outside the tree: at the end of its source
+   * or the start of its destination when the edge is the only one there,
+   * and else in a new block on the edge. An edge to the exit counts at the
+   * start of its source, which a call to exit() may never leave. An edge
+   * out of a terminator other than a branch or a switch cannot be split, so
+   * buildGraph gives it the highest weight; should it still close a cycle
+   * of such edges, which needs an invoke or an indirectbr, its counter goes
+   * to the destination and the counts of the function are not exact.
+   */
+  void instrument(Function &F, const std::vector<ProfileEdge> &edges, unsigned edgeBase) {
+    std::vector<BasicBlock*> blocks;
+    for (auto &BB: F) {
+      blocks.push_back(&BB);
+    }
+    for (unsigned e = 0; e < edges.size(); ++e) {
+      if (edges[e].InTree)
+        continue;
+      auto src = blocks[edges[e].Src];
+      auto terminator = src->getTerminator();
+      if (edges[e].Succ == ~0u) {
+        IRBuilder<> Builder(&*src->getFirstInsertionPt());
+        Counters->emitIncrement(Builder, edgeBase + e);
+        continue;
+      }
+      if (terminator->getNumSuccessors() == 1) {
+        IRBuilder<> Builder(terminator);
+        Counters->emitIncrement(Builder, edgeBase + e);
+        continue;
+      }
+      auto dst = terminator->getSuccessor(edges[e].Succ);
+      if (dst->getSinglePredecessor()) {
+        IRBuilder<> Builder(&*dst->getFirstInsertionPt());
+        Counters->emitIncrement(Builder, edgeBase + e);
+        continue;
+      }
+      if (!isa<BranchInst>(terminator) && !isa<SwitchInst>(terminator)) {
+        IRBuilder<> Builder(&*dst->getFirstInsertionPt());
+        Counters->emitIncrement(Builder, edgeBase + e);
+        continue;
+      }
+      // split the edge; one Phi entry of src moves to the new block
+      auto edge = BasicBlock::Create(F.getContext(), "edge", &F, dst);
+      IRBuilder<> Builder(edge);
+      Counters->emitIncrement(Builder, edgeBase + e);
+      Builder.CreateBr(dst);
+      terminator->setSuccessor(edges[e].Succ, edge);
+      for (auto &phi: dst->phis()) {
+        phi.setIncomingBlock(phi.getBasicBlockIndex(src), edge);
+      }
+    }
+  }
+
+  // The branch sites, whose outcomes are the edges of their block
+  void collectBranches(Function &F, const std::vector<ProfileEdge> &edges, unsigned edgeBase) {
+    unsigned b = 0, e = 0;
+    for (auto &BB: F) {
+      // the edges of a block are consecutive, in successor order
+      while (e < edges.size() && edges[e].Src != b) {
+        e++;
+      }
+      Branches.addSites(BB.getTerminator(), b, edgeBase + e);
+      b++;
+    }
+  }
+
+  // Solve the counts, print the branches and report the instruction counts
+  Function* createFlush(Module &M, OpcodeHistograms &histograms, unsigned blockBase,
+                        const std::vector<SolveStep> &steps) {
+    auto &CTX = M.getContext();
+    auto i64 = Type::getInt64Ty(CTX);
+    std::vector<unsigned> target, begin, term, negate;
+    for (auto &step: steps) {
+      target.push_back(step.Target);
+      begin.push_back(term.size());
+      for (auto &t: step.Terms) {
+        term.push_back(t.first);
+        negate.push_back(t.second);
+      }
+    }
+    begin.push_back(term.size());
+    auto targetTable = createTable(M, target, "cse231.edges.target");
+    auto beginTable = createTable(M, begin, "cse231.edges.begin");
+    auto termTable = createTable(M, term, "cse231.edges.term");
+    auto negateTable = createTable(M, negate, "cse231.edges.negate");
+
+    auto flush = Function::Create(FunctionType::get(Type::getVoidTy(CTX), false),
+                                  GlobalValue::InternalLinkage, "cse231.edges.flush", &M);
+    IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", flush));
+    auto sum = Builder.CreateAlloca(i64);
+    Counters->emitMerge(Builder);
+    emitLoop(Builder, Builder.getInt32(0), Builder.getInt32(steps.size()), [&](Value *s) {
+      Builder.CreateStore(ConstantInt::get(i64, 0), sum);
+      auto end = emitLoad(Builder, beginTable, Builder.CreateAdd(s, Builder.getInt32(1)));
+      emitLoop(Builder, emitLoad(Builder, beginTable, s), end, [&](Value *k) {
+        auto count = emitLoad(Builder, Counts, emitLoad(Builder, termTable, k));
+        auto negated = Builder.CreateICmpNE(emitLoad(Builder, negateTable, k), Builder.getInt32(0));
+        auto total = Builder.CreateLoad(i64, sum);
+        Builder.CreateStore(Builder.CreateSelect(negated, Builder.CreateSub(total, count),
+                                                 Builder.CreateAdd(total, count)), sum);
+      });
+      Builder.CreateStore(Builder.CreateLoad(i64, sum),
+                          emitElement(Builder, Counts, emitLoad(Builder, targetTable, s)));
+    });
+
+    Branches.emitReport(Builder, Counts, "cse231.edges.sites");
+    histograms.emitFold(Builder, Counts, blockBase);
+    Builder.CreateRetVoid();
+    return flush;
+  }
+
+  BranchSites Branches;
+  std::unique_ptr<ProfileCounters> Counters;
+  GlobalVariable* Counts = nullptr;
+};
+} // namespace
+
+char EdgeProfiler::ID = 0;
+static RegisterPass<EdgeProfiler> X(
+  "cse231-edges",
+  "Spanning-tree Edge Profiling",
+  false, // This pass modifies the CFG => false
+  false // This pass is not a pure analysis pass => false
+);
@@ -1,37 +1,47 @@
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "../DFA/231DFA.h"
-#include <set>
+#include "../DFA/231Driver.h"
 
 namespace {
 using namespace llvm;
 
+cl::opt<bool> BlockSolver("cse231-reaching-block-solver",
+    cl::desc("Solve reaching definitions at basic block granularity"));
+
+cl::opt<unsigned> Threads("cse231-reaching-threads",
+    cl::desc("Number of threads analyzing functions (0: one per hardware thread)"),
+    cl::init(1));
+
 struct ReachingInfo: Info {
   ReachingInfo() = default;
+  ReachingInfo(unsigned s): reaches{s} {}
   ReachingInfo(const ReachingInfo& other) {
     this->reaches = other.reaches;
   }
   ~ReachingInfo() override = default;
 
-  void print() override {
-    for (auto &i: reaches)
-      errs() << i << '|';
-    errs() << '\n';
+  void print(raw_ostream &OS) override {
+    for (unsigned i: reaches.set_bits())
+      OS << i << '|';
+    OS << '\n';
   }
 
   void set(unsigned i) {
-    reaches.insert(i);
+    reaches.set(i);
   }
 
   static bool equals(ReachingInfo* lhs, ReachingInfo* rhs) {
     return lhs->reaches == rhs->reaches;
   }
 
-  // Union operation of sets
+  // Union operation of sets, word by word
   ReachingInfo& operator+(const ReachingInfo& other) {
-    reaches.insert(other.reaches.begin(), other.reaches.end());
+    reaches |= other.reaches;
     return *this;
   }
   // I won't use this method
@@ -39,61 +49,113 @@ struct ReachingInfo: Info {
     return nullptr;
   }
 private:
-  // use std::set to represent bit-vector
-  std::set<unsigned> reaches;
+  // one bit per instruction index
+  BitVector reaches;
 };
 
 struct ReachingDefinitionAnalysis: DataFlowAnalysis<ReachingInfo, true> {
-  ReachingDefinitionAnalysis(): DataFlowAnalysis(bottom, initState) {}
+  ReachingDefinitionAnalysis(ReachingInfo bottom, ReachingInfo initState)
+    : DataFlowAnalysis(bottom, initState) {}
   ~ReachingDefinitionAnalysis() override {}
 
 private:
+  /*
+   * Precompute the gen set of every instruction, and of every basic block
+   * for the block solver. A definition is an SSA value and is defined exactly
+   * once, so the kill sets are empty and the transfer is out = in ∪ gen.
+   */
+  void prepare(Function* F) override {
+    GenBegin.assign(1, 0);
+    Gens.clear();
+    BlockGens.clear();
+
+    for (unsigned idx = 0; idx < IndexToInstr.size(); ++idx) {
+      auto I = IndexToInstr[idx];
+      if (I == nullptr || isa<BranchInst>(I) || isa<SwitchInst>(I) || isa<StoreInst>(I)) {
+        // the dummy node and instructions that do not define a value
+      } else if (isa<BinaryOperator>(I) || isa<AllocaInst>(I) || isa<LoadInst>(I) ||
+                 isa<GetElementPtrInst>(I) || isa<CmpInst>(I) || isa<SelectInst>(I)) {
+        Gens.push_back(idx);
+      } else if (isa<PHINode>(I) && I == &I->getParent()->front()) {
+        // the leading Phi stands for the consecutive Phi instructions
+        auto BB = I->getParent();
+        auto end = BB->getFirstNonPHI();
+        for (auto ii = BB->begin(); &*ii != end; ++ii) {
+          Gens.push_back(InstrToIndex[&*ii]);
+        }
+      }
+      // others are treated as do not return a value
+      GenBegin.push_back(Gens.size());
+    }
+
+    if (!BlockSolver)
+      return;
+    for (auto &BB: *F) {
+      auto &gen = BlockGens[&BB];
+      for (auto &I: BB) {
+        unsigned idx = InstrToIndex[&I];
+        gen.insert(gen.end(), Gens.begin() + GenBegin[idx], Gens.begin() + GenBegin[idx + 1]);
+      }
+    }
+  }
+
   void flowfunction(Instruction* I, std::vector<unsigned>& IncomingEdges,
                     std::vector<unsigned>& OutgoingEdges, std::vector<ReachingInfo*>& Infos) override {
-    unsigned cur = InstrToIndex.at(I);
+    unsigned cur = InstrToIndex.lookup(I);
 
-    ReachingInfo in, out;
+    ReachingInfo in{(unsigned)IndexToInstr.size()};
     for (auto &i: IncomingEdges) {
       in = in + *(EdgeToInfo.at({i, cur}));
     }
+    for (unsigned i = GenBegin[cur]; i != GenBegin[cur + 1]; ++i) {
+      in.set(Gens[i]);
+    }
+    // all n outgoing edges share one copy of out
+    Infos.assign(OutgoingEdges.size(), newInfo(in));
+    return;
+  }
 
-    if (isa<BranchInst>(I) || isa<SwitchInst>(I) || isa<StoreInst>(I)) {
-      out = in;
-    } else if (isa<BinaryOperator>(I) || isa<AllocaInst>(I) || isa<LoadInst>(I) || 
-               isa<GetElementPtrInst>(I) || isa<CmpInst>(I) || isa<SelectInst>(I)) {
-      in.set(cur);
-      out = in;
-    } else if (isa<PHINode>(I)) {
-      auto BB = I->getParent();
-      auto end = BB->getFirstNonPHI();
-      // iter over consecutive Phi instructions
-      for (auto ii = BB->begin(); &*ii != end; ++ii) {
-        in.set(InstrToIndex[&*ii]);
-      }
-      out = in;
-    } else {
-      // treated as do not return a value
-      out = in;
+  // the same transfer with the gen set of the whole block
+  bool blockflowfunction(Instruction* First, Instruction* Last, std::vector<unsigned>& IncomingEdges,
+                         std::vector<unsigned>& OutgoingEdges, std::vector<ReachingInfo*>& Infos) override {
+    if (OutgoingEdges.empty())
+      return true;
+    unsigned head = InstrToIndex.lookup(First);
+
+    ReachingInfo in{(unsigned)IndexToInstr.size()};
+    for (auto &i: IncomingEdges) {
+      in = in + *(EdgeToInfo.at({i, head}));
     }
-    // return n copies of out, for n outgoing edges
-    for (size_t i = 0; i < OutgoingEdges.size(); ++i) {
-      Infos.push_back(new ReachingInfo(out));
+    for (unsigned d: BlockGens[First->getParent()]) {
+      in.set(d);
     }
-    return;
+    Infos.assign(OutgoingEdges.size(), newInfo(in));
+    return true;
   }
 
-  static ReachingInfo bottom;
-  static ReachingInfo initState;
+  // Gens[GenBegin[i] .. GenBegin[i + 1]) is the gen set of node i
+  std::vector<unsigned> GenBegin;
+  std::vector<unsigned> Gens;
+  DenseMap<BasicBlock*, std::vector<unsigned>> BlockGens;
 };
 
-ReachingInfo ReachingDefinitionAnalysis::bottom = ReachingInfo{};
-ReachingInfo ReachingDefinitionAnalysis::initState = ReachingInfo{};
+// Every edge carries a bit-vector with one bit per node, the dummy node included
+ReachingDefinitionAnalysis* createReachingAnalysis(Function &F) {
+  uint size = 1;
+  for (auto &BB: F) {
+    size += BB.size();
+  }
+  ReachingInfo bottom{size};
+  ReachingInfo initState{size};
+  return new ReachingDefinitionAnalysis(bottom, initState);
+}
 
 } // namespace
 
 struct NewReachingPass: PassInfoMixin<NewReachingPass> {
   PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
-    auto r = new ReachingDefinitionAnalysis();
+    auto r = createReachingAnalysis(F);
+    r->setBlockSolver(BlockSolver);
     r->runWorklistAlgorithm(&F);
     r->print();
     delete r;
@@ -116,15 +178,19 @@ llvmGetPassPluginInfo() {
           }};
 }
 
-struct LegacyReachingPass: public FunctionPass {
+struct LegacyReachingPass: public ModulePass {
   static char ID;
-  LegacyReachingPass() : FunctionPass(ID) {}
-
-  bool runOnFunction(Function &F) override {
-    auto r = new ReachingDefinitionAnalysis();
-    r->runWorklistAlgorithm(&F);
-    r->print();
-    delete r;
+  LegacyReachingPass() : ModulePass(ID) {}
+
+  // functions are independent, analyze them concurrently
+  bool runOnModule(Module &M) override {
+    runOnFunctions(M, Threads, [](Function &F, raw_ostream &OS) {
+      auto r = createReachingAnalysis(F);
+      r->setBlockSolver(BlockSolver);
+      r->runWorklistAlgorithm(&F);
+      r->print(OS);
+      delete r;
+    });
     // Doesn't modify the input unit of IR, hence 'false'
     return false;
   }
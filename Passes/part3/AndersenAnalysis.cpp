@@ -0,0 +1,116 @@
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "../DFA/231Andersen.h"
+#include <string>
+
+namespace {
+using namespace llvm;
+
+struct AndersenPrinter {
+  AndersenPrinter(Module &M, AndersenAnalysis &aa, raw_ostream &OS)
+    : aa(aa), MST(&M), OS(OS) {
+    // objects are printed as @global or function:%alloca
+    for (auto &G: M.globals()) {
+      raw_string_ostream name(Names[&G]);
+      G.printAsOperand(name, false, MST);
+    }
+    for (auto &F: M) {
+      MST.incorporateFunction(F);
+      for (auto &I: instructions(F)) {
+        if (isa<AllocaInst>(I)) {
+          raw_string_ostream name(Names[&I]);
+          name << F.getName() << ":";
+          I.printAsOperand(name, false, MST);
+        }
+      }
+    }
+  }
+
+  /*
+   * First the content of the globals, then a line per function with its
+   * pointers and the content of its allocas.
+   */
+  void print(Module &M) {
+    for (auto &G: M.globals()) {
+      printContent(G);
+    }
+    OS << "\n";
+
+    for (auto &F: M) {
+      if (F.isDeclaration())
+        continue;
+      MST.incorporateFunction(F);
+      OS << F.getName() << ":";
+      for (auto &arg: F.args()) {
+        printPointer(arg);
+      }
+      for (auto &I: instructions(F)) {
+        printPointer(I);
+      }
+      for (auto &I: instructions(F)) {
+        if (isa<AllocaInst>(I))
+          printContent(I);
+      }
+      OS << "\n";
+    }
+  }
+
+private:
+  void printPointer(Value &V) {
+    auto &pts = aa.getPointsTo(&V);
+    if (pts.empty())
+      return;
+    V.printAsOperand(OS, false, MST);
+    printSet(pts);
+  }
+
+  void printContent(Value &object) {
+    auto &pts = aa.getContentPointsTo(&object);
+    if (pts.empty())
+      return;
+    OS << "*" << Names[&object];
+    printSet(pts);
+  }
+
+  void printSet(const AndersenAnalysis::PointsTo &pts) {
+    OS << "->(";
+    for (unsigned o: pts) {
+      OS << Names[aa.getObject(o)] << "/";
+    }
+    OS << ")|";
+  }
+
+  AndersenAnalysis &aa;
+  ModuleSlotTracker MST;
+  raw_ostream &OS;
+  DenseMap<Value*, std::string> Names;
+};
+
+} // namespace
+
+struct LegacyAndersenPass: public ModulePass {
+  static char ID;
+  LegacyAndersenPass(): ModulePass(ID) {}
+
+  bool runOnModule(Module &M) override {
+    AndersenAnalysis aa(M);
+
+    // errs() is unbuffered, write the output at once
+    std::string out;
+    raw_string_ostream OS(out);
+    AndersenPrinter(M, aa, OS).print(M);
+    errs() << OS.str();
+    // Doesn't modify the input unit of IR, hence 'false'
+    return false;
+  }
+};
+
+char LegacyAndersenPass::ID = 0;
+static RegisterPass<LegacyAndersenPass> X(
+    "cse231-andersen",
+    "Andersen Points-To Analysis",
+    true, // This pass doesn't modify the CFG => true
+    false // This pass is not a pure analysis pass => false
+);
@@ -1,14 +1,43 @@
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/IR/InstIterator.h"
 
 #include "../DFA/231DFA.h"
+#include "../DFA/231Driver.h"
+#include <algorithm>
+#include <cstdint>
 #include <map>
 
 namespace {
 using namespace llvm;
 
+cl::opt<bool> BlockSolver("cse231-liveness-block-solver",
+    cl::desc("Solve liveness at basic block granularity"));
+
+enum class LivenessEngine { Dense, Slab, Sparse };
+cl::opt<LivenessEngine> Engine("cse231-liveness-engine",
+    cl::desc("Choose the liveness solver"),
+    cl::values(
+      clEnumValN(LivenessEngine::Dense, "dense", "one LivenessInfo per edge (default)"),
+      clEnumValN(LivenessEngine::Slab, "slab", "live sets of all nodes in one word-packed slab"),
+      clEnumValN(LivenessEngine::Sparse, "sparse", "live range of each SSA value from its uses")),
+    cl::init(LivenessEngine::Dense));
+
+cl::opt<unsigned> Threads("cse231-liveness-threads",
+    cl::desc("Number of threads analyzing functions (0: one per hardware thread)"),
+    cl::init(1));
+
+// First Category: IR instructions that return a value
+bool isFirstCategory(Instruction* I) {
+  return isa<BinaryOperator>(I) || isa<AllocaInst>(I) || isa<LoadInst>(I) ||
+         isa<GetElementPtrInst>(I) || isa<CmpInst>(I) || isa<SelectInst>(I);
+}
+
 struct LivenessInfo: Info {
   LivenessInfo() = default;
   LivenessInfo(unsigned s): bits{s} {}
@@ -17,13 +46,13 @@ struct LivenessInfo: Info {
   }
   ~LivenessInfo() override = default;
 
-  void print() override {
+  void print(raw_ostream &OS) override {
     for (size_t i = 0; i != bits.size(); ++i) {
       if (bits[i]) {
-        errs() << i << '|';
+        OS << i << '|';
       }
     }
-    errs() << '\n';
+    OS << '\n';
   }
 
   void set(unsigned idx) {
@@ -34,6 +63,10 @@ struct LivenessInfo: Info {
     bits.reset(idx);
   }
 
+  bool test(unsigned idx) const {
+    return bits.test(idx);
+  }
+
   static bool equals(LivenessInfo* lhs, LivenessInfo* rhs) {
     return lhs->bits == rhs->bits;
   }
@@ -50,10 +83,217 @@ struct LivenessAnalysis: DataFlowAnalysis<LivenessInfo, false> {
   LivenessAnalysis(LivenessInfo bottom, LivenessInfo initState): DataFlowAnalysis(bottom, initState) {}
   ~LivenessAnalysis() override {}
 
+  /*
+   * The slab engine computes the same edges as runWorklistAlgorithm without
+   * LivenessInfo objects. The live set on the outgoing edges of every node is
+   * a row of one contiguous slab of words, and only values produced by
+   * instructions get a bit. A visit ORs the rows of the incoming edges into a
+   * scratch row, applies the precomputed uses and kills of the node, and ORs
+   * the result into the node's row in place. Live sets only grow from bottom,
+   * so the node changed iff that OR added a bit.
+   */
+  void runSlabAlgorithm(Function* F) {
+    initializeBackwardMap(F);
+    prepareTransfer();
+    NumWords = (BitToIndex.size() + WordBits - 1) / WordBits;
+    Slab.assign((size_t)IndexToInstr.size() * NumWords, 0);
+    computeNodeRanks();
+    NumIterations = 0;
+    NumVisits = 0;
+    Mode = LivenessEngine::Slab;
+
+    OrderedWorklist worklist;
+    worklist.reset(NodeRank);
+    for (unsigned i = 0; i < IndexToInstr.size(); ++i) {
+      worklist.push(i);
+    }
+
+    std::vector<Word> scratch(NumWords);
+    while (!worklist.empty()) {
+      unsigned cur = worklist.pop();
+      NumIterations++;
+      // skip 0-indegree or 0-outdegree instructions, as the dense solver does
+      if (PredBegin[cur] == PredBegin[cur + 1] || SuccBegin[cur] == SuccBegin[cur + 1]) {
+        continue;
+      }
+      NumVisits++;
+
+      std::fill(scratch.begin(), scratch.end(), 0);
+      for (unsigned q = PredBegin[cur]; q != PredBegin[cur + 1]; ++q) {
+        const Word* row = &Slab[Preds[q] * NumWords];
+        for (unsigned w = 0; w < NumWords; ++w) {
+          scratch[w] |= row[w];
+        }
+        unsigned e = PredEdge[q];
+        for (unsigned i = ExtraBegin[e]; i != ExtraBegin[e + 1]; ++i) {
+          setBit(scratch.data(), Extras[i]);
+        }
+      }
+      for (unsigned i = UseBegin[cur]; i != UseBegin[cur + 1]; ++i) {
+        setBit(scratch.data(), Uses[i]);
+      }
+      for (unsigned i = KillBegin[cur]; i != KillBegin[cur + 1]; ++i) {
+        scratch[Kills[i] / WordBits] &= ~(Word(1) << (Kills[i] % WordBits));
+      }
+
+      Word added = 0;
+      Word* row = &Slab[cur * NumWords];
+      for (unsigned w = 0; w < NumWords; ++w) {
+        added |= scratch[w] & ~row[w];
+        row[w] |= scratch[w];
+      }
+      if (added) {
+        for (unsigned k = SuccBegin[cur]; k != SuccBegin[cur + 1]; ++k) {
+          worklist.push(Succs[k]);
+        }
+      }
+    }
+  }
+
+  /*
+   * The sparse engine uses the SSA form: each value is live exactly on the
+   * nodes reached by walking the edges from its uses until a node that kills
+   * it (its definition, or the leading Phi for a Phi). Each value is walked
+   * once, so the work is the total size of the live ranges instead of
+   * nodes x values. The walk obeys the same rules as flowfunction: nodes
+   * without incoming or outgoing edges do not propagate, and Phi operands
+   * enter on the single outgoing edge that flowfunction picks.
+   */
+  void runSparseAlgorithm(Function* F) {
+    initializeBackwardMap(F);
+    prepareTransfer();
+    NumIterations = 0;
+    NumVisits = 0;
+    Mode = LivenessEngine::Sparse;
+
+    unsigned numNodes = IndexToInstr.size();
+    unsigned numBits = BitToIndex.size();
+    // invert the transfer: the nodes using each value, the edges it is
+    // added to, and the node killing it
+    std::vector<unsigned> userBegin(numBits + 1, 0), users(Uses.size());
+    std::vector<unsigned> extraBegin(numBits + 1, 0), extraEdges(Extras.size());
+    std::vector<unsigned> killer(numBits, ~0u);
+    for (unsigned b: Uses) userBegin[b + 1]++;
+    for (unsigned b: Extras) extraBegin[b + 1]++;
+    for (unsigned b = 0; b < numBits; ++b) {
+      userBegin[b + 1] += userBegin[b];
+      extraBegin[b + 1] += extraBegin[b];
+    }
+    std::vector<unsigned> userFill(userBegin.begin(), userBegin.end() - 1);
+    std::vector<unsigned> extraFill(extraBegin.begin(), extraBegin.end() - 1);
+    for (unsigned n = 0; n < numNodes; ++n) {
+      for (unsigned i = UseBegin[n]; i != UseBegin[n + 1]; ++i) {
+        users[userFill[Uses[i]]++] = n;
+      }
+      for (unsigned i = KillBegin[n]; i != KillBegin[n + 1]; ++i) {
+        killer[Kills[i]] = n;
+      }
+    }
+    for (unsigned e = 0; e < Succs.size(); ++e) {
+      for (unsigned i = ExtraBegin[e]; i != ExtraBegin[e + 1]; ++i) {
+        extraEdges[extraFill[Extras[i]]++] = e;
+      }
+    }
+
+    LiveBits.assign(numNodes, {});
+    // Stamp[n] == b + 1 once value b is live on the outgoing edges of node n
+    std::vector<unsigned> stamp(numNodes, 0);
+    std::vector<unsigned> stack;
+    for (unsigned b = 0; b < numBits; ++b) {
+      auto reach = [&](unsigned n) {
+        if (stamp[n] == b + 1 || n == killer[b] ||
+            PredBegin[n] == PredBegin[n + 1] || SuccBegin[n] == SuccBegin[n + 1]) {
+          return;
+        }
+        stamp[n] = b + 1;
+        LiveBits[n].push_back(b);
+        stack.push_back(n);
+        NumVisits++;
+      };
+
+      for (unsigned i = userBegin[b]; i != userBegin[b + 1]; ++i) {
+        reach(users[i]);
+      }
+      for (unsigned i = extraBegin[b]; i != extraBegin[b + 1]; ++i) {
+        reach(Succs[extraEdges[i]]);
+      }
+      while (!stack.empty()) {
+        unsigned cur = stack.back();
+        stack.pop_back();
+        NumIterations++;
+        for (unsigned k = SuccBegin[cur]; k != SuccBegin[cur + 1]; ++k) {
+          reach(Succs[k]);
+        }
+      }
+    }
+  }
+
+  /*
+   * Whether the value of I is live on an edge leaving I in program order,
+   * that is on an incoming edge of its node, in the results of any engine.
+   */
+  bool isLiveOut(Instruction* I) {
+    unsigned idx = InstrToIndex.lookup(I);
+    if (Mode == LivenessEngine::Dense) {
+      if (!Materialized)
+        materialize();
+      for (unsigned q = PredBegin[idx]; q != PredBegin[idx + 1]; ++q) {
+        if (EdgeToInfo.at({Preds[q], idx})->test(idx))
+          return true;
+      }
+      return false;
+    }
+
+    unsigned bit = IndexToBit[idx];
+    if (bit == ~0u)
+      return false;
+    for (unsigned q = PredBegin[idx]; q != PredBegin[idx + 1]; ++q) {
+      unsigned p = Preds[q], e = PredEdge[q];
+      if (Mode == LivenessEngine::Slab && (Slab[p * NumWords + bit / WordBits] >> (bit % WordBits) & 1))
+        return true;
+      if (Mode == LivenessEngine::Sparse && std::binary_search(LiveBits[p].begin(), LiveBits[p].end(), bit))
+        return true;
+      if (std::find(Extras.begin() + ExtraBegin[e], Extras.begin() + ExtraBegin[e + 1], bit) !=
+          Extras.begin() + ExtraBegin[e + 1])
+        return true;
+    }
+    return false;
+  }
+
+  using DataFlowAnalysis::print;
+  void print(raw_ostream &OS) override {
+    if (Mode == LivenessEngine::Dense) {
+      DataFlowAnalysis::print(OS);
+      return;
+    }
+    if (Mode == LivenessEngine::Sparse) {
+      printSparse(OS);
+      return;
+    }
+
+    std::vector<Word> scratch(NumWords);
+    for (unsigned src = 0; src < IndexToInstr.size(); ++src) {
+      for (unsigned e = SuccBegin[src]; e != SuccBegin[src + 1]; ++e) {
+        std::copy(&Slab[src * NumWords], &Slab[(src + 1) * NumWords], scratch.begin());
+        for (unsigned i = ExtraBegin[e]; i != ExtraBegin[e + 1]; ++i) {
+          setBit(scratch.data(), Extras[i]);
+        }
+
+        OS << "Edge " << src << "->" "Edge " << Succs[e] << ":";
+        for (unsigned w = 0; w < NumWords; ++w) {
+          for (Word x = scratch[w]; x != 0; x &= x - 1) {
+            OS << BitToIndex[w * WordBits + countTrailingZeros(x)] << '|';
+          }
+        }
+        OS << '\n';
+      }
+    }
+  }
+
 private:
   void flowfunction(Instruction* I, std::vector<unsigned>& IncomingEdges,
                     std::vector<unsigned>& OutgoingEdges, std::vector<LivenessInfo*>& Infos) override {
-    unsigned cur = InstrToIndex.at(I);
+    unsigned cur = InstrToIndex.lookup(I);
 
     LivenessInfo in;
     for (auto &i: IncomingEdges) {
@@ -71,67 +311,281 @@ private:
       }
     };
 
-    if (isa<BinaryOperator>(I) || isa<AllocaInst>(I) || isa<LoadInst>(I) || 
-        isa<GetElementPtrInst>(I) || isa<CmpInst>(I) || isa<SelectInst>(I)) {
-      // First Category: IR instructions that return a value
+    if (isFirstCategory(I)) {
       joinDefs(in, I);
       in.reset(cur);
-      // return n copies of out, for n outgoing edges
-      for (size_t i = 0; i < OutgoingEdges.size(); ++i) {
-        Infos[i] = new LivenessInfo(in);
-      }
+      // all n outgoing edges share one copy of out
+      Infos.assign(OutgoingEdges.size(), newInfo(in));
     } else if (isa<PHINode>(I)) {
-      auto BB = I->getParent();
-      auto end = BB->getFirstNonPHI();
-      // iter over consecutive Phi instructions
-      for (auto ii = BB->begin(); &*ii != end; ++ii) {
-        in.reset(InstrToIndex[&*ii]);
-      }
-      std::map<uint, uint> edge2idx;
-      for (size_t i = 0; i < OutgoingEdges.size(); ++i) {
-        edge2idx.insert(std::make_pair(OutgoingEdges[i], i));
-        Infos[i] = new LivenessInfo(in);
-      }
-      // iter over consecutive Phi instructions again
-      for (auto ii = BB->begin(); &*ii != end; ++ii) {
-        auto *phi = dyn_cast<PHINode>(&*ii);
-        for (auto &v: phi->incoming_values()) {
-          if (auto *instr = dyn_cast<Instruction>(v)) {
-            auto dst = InstrToIndex[instr];
-            Infos[edge2idx[dst]]->set(dst);
-          }
-        }
-      }
+      phiflowfunction(in, I->getParent(), OutgoingEdges, Infos);
     } else {
       // Second Category: IR instructions that do not return a value
       // includes BranchInst, SwitchInst, StoreInst, CallInst and the not mentioned
       joinDefs(in, I);
-      // return n copies of out, for n outgoing edges
-      for (size_t i = 0; i < OutgoingEdges.size(); ++i) {
-        Infos[i] = new LivenessInfo(in);
+      // all n outgoing edges share one copy of out
+      Infos.assign(OutgoingEdges.size(), newInfo(in));
+    }
+  }
+
+  // The leading Phi of BB, standing for the consecutive Phi instructions
+  void phiflowfunction(LivenessInfo& in, BasicBlock* BB, std::vector<unsigned>& OutgoingEdges,
+                       std::vector<LivenessInfo*>& Infos) {
+    auto end = BB->getFirstNonPHI();
+    // iter over consecutive Phi instructions
+    for (auto ii = BB->begin(); &*ii != end; ++ii) {
+      in.reset(InstrToIndex[&*ii]);
+    }
+    std::map<uint, uint> edge2idx;
+    Infos.assign(OutgoingEdges.size(), nullptr);
+    for (size_t i = 0; i < OutgoingEdges.size(); ++i) {
+      edge2idx.insert(std::make_pair(OutgoingEdges[i], i));
+      // edges differ below, so each gets its own copy
+      Infos[i] = newInfo(in);
+    }
+    // Note: the value is looked up among the outgoing edges by its own index,
+    // so unless it happens to be a predecessor's terminator, it lands on edge 0.
+    // iter over consecutive Phi instructions again
+    for (auto ii = BB->begin(); &*ii != end; ++ii) {
+      auto *phi = dyn_cast<PHINode>(&*ii);
+      for (auto &v: phi->incoming_values()) {
+        if (auto *instr = dyn_cast<Instruction>(v)) {
+          auto dst = InstrToIndex[instr];
+          Infos[edge2idx[dst]]->set(dst);
+        }
       }
     }
   }
-};
 
-} // namespace
+  /*
+   * Precompute the use and def sets of the non-Phi instructions of every
+   * basic block for the block solver, scanning them backward: a value is in
+   * the use set if it is used before it is defined in the block.
+   */
+  void prepare(Function* F) override {
+    BlockUses.clear();
+    BlockDefs.clear();
+    if (!BlockSolver)
+      return;
 
-struct LegacyLivenessPass: public FunctionPass {
-  static char ID;
-  LegacyLivenessPass(): FunctionPass(ID) {}
+    BitVector use(IndexToInstr.size());
+    for (auto &BB: *F) {
+      use.reset();
+      auto &defs = BlockDefs[&BB];
+      for (auto ii = BB.rbegin(); !isa<PHINode>(*ii); ++ii) {
+        Instruction* I = &*ii;
+        for (Use &U: I->operands()) {
+          if (auto *instr = dyn_cast<Instruction>(U.get())) {
+            use.set(InstrToIndex[instr]);
+          }
+        }
+        if (isFirstCategory(I)) {
+          unsigned idx = InstrToIndex[I];
+          use.reset(idx);
+          defs.push_back(idx);
+        }
+        if (I == &BB.front())
+          break;
+      }
+      auto &uses = BlockUses[&BB];
+      for (unsigned idx: use.set_bits()) {
+        uses.push_back(idx);
+      }
+    }
+  }
 
-  bool runOnFunction(Function &F) override {
-    uint size = 1;
-    for (auto &BB: F) {
-      size += BB.size();
+  // the same transfer with the use and def sets of the whole block:
+  // out = use ∪ (in − def), followed by the Phis if the block has any
+  bool blockflowfunction(Instruction* First, Instruction* Last, std::vector<unsigned>& IncomingEdges,
+                         std::vector<unsigned>& OutgoingEdges, std::vector<LivenessInfo*>& Infos) override {
+    if (OutgoingEdges.empty())
+      return true;
+    unsigned head = InstrToIndex.lookup(First);
+
+    LivenessInfo in;
+    for (auto &i: IncomingEdges) {
+      in.join(*(EdgeToInfo.at({i, head})));
+    }
+    auto BB = First->getParent();
+    for (unsigned d: BlockDefs[BB]) {
+      in.reset(d);
+    }
+    for (unsigned u: BlockUses[BB]) {
+      in.set(u);
+    }
+
+    if (isa<PHINode>(Last)) {
+      phiflowfunction(in, BB, OutgoingEdges, Infos);
+    } else {
+      // all n outgoing edges share one copy of out
+      Infos.assign(OutgoingEdges.size(), newInfo(in));
+    }
+    return true;
+  }
+
+  using Word = uint64_t;
+  static constexpr unsigned WordBits = 64;
+
+  void setBit(Word* row, unsigned bit) {
+    row[bit / WordBits] |= Word(1) << (bit % WordBits);
+  }
+
+  // Print the sorted union of the live bits of the source and the edge's own bits
+  void printSparse(raw_ostream &OS) {
+    for (unsigned src = 0; src < IndexToInstr.size(); ++src) {
+      for (unsigned e = SuccBegin[src]; e != SuccBegin[src + 1]; ++e) {
+        OS << "Edge " << src << "->" "Edge " << Succs[e] << ":";
+        auto live = LiveBits[src].begin(), liveEnd = LiveBits[src].end();
+        auto extra = Extras.begin() + ExtraBegin[e], extraEnd = Extras.begin() + ExtraBegin[e + 1];
+        while (live != liveEnd || extra != extraEnd) {
+          unsigned b;
+          if (extra == extraEnd || (live != liveEnd && *live < *extra)) {
+            b = *live++;
+          } else {
+            if (live != liveEnd && *live == *extra)
+              ++live;
+            b = *extra++;
+          }
+          OS << BitToIndex[b] << '|';
+        }
+        OS << '\n';
+      }
     }
-    LivenessInfo bottom{size};
-    LivenessInfo initState{size};
+  }
+
+  /*
+   * Number the values, and precompute the uses and kills of each node and the
+   * phi operands added to single outgoing edges, following flowfunction.
+   */
+  void prepareTransfer() {
+    unsigned numNodes = IndexToInstr.size();
+    IndexToBit.assign(numNodes, ~0u);
+    BitToIndex.clear();
+    for (unsigned idx = 1; idx < numNodes; ++idx) {
+      if (!IndexToInstr[idx]->getType()->isVoidTy()) {
+        IndexToBit[idx] = BitToIndex.size();
+        BitToIndex.push_back(idx);
+      }
+    }
+    // position of each incoming edge among the outgoing edges of its source
+    PredEdge.resize(Preds.size());
+    std::vector<unsigned> predFill(PredBegin.begin(), PredBegin.end() - 1);
+    for (unsigned src = 0; src < numNodes; ++src) {
+      for (unsigned e = SuccBegin[src]; e != SuccBegin[src + 1]; ++e) {
+        PredEdge[predFill[Succs[e]]++] = e;
+      }
+    }
+
+    UseBegin.assign(1, 0);
+    KillBegin.assign(1, 0);
+    Uses.clear();
+    Kills.clear();
+    std::vector<std::vector<unsigned>> extras(Succs.size());
+    for (unsigned idx = 0; idx < numNodes; ++idx) {
+      Instruction* I = IndexToInstr[idx];
+      if (I == nullptr) {
+        // the dummy node
+      } else if (isa<PHINode>(I)) {
+        // only the leading Phi has edges; it stands for the consecutive Phis
+        auto BB = I->getParent();
+        auto end = BB->getFirstNonPHI();
+        if (I == &BB->front() && SuccBegin[idx] != SuccBegin[idx + 1]) {
+          for (auto ii = BB->begin(); &*ii != end; ++ii) {
+            Kills.push_back(IndexToBit[InstrToIndex[&*ii]]);
+          }
+          for (auto ii = BB->begin(); &*ii != end; ++ii) {
+            for (auto &v: cast<PHINode>(&*ii)->incoming_values()) {
+              if (auto *instr = dyn_cast<Instruction>(v)) {
+                unsigned dst = InstrToIndex[instr];
+                unsigned e = SuccBegin[idx];
+                for (unsigned k = SuccBegin[idx]; k != SuccBegin[idx + 1]; ++k) {
+                  if (Succs[k] == dst) {
+                    e = k;
+                    break;
+                  }
+                }
+                extras[e].push_back(IndexToBit[dst]);
+              }
+            }
+          }
+        }
+      } else {
+        for (Use &U: I->operands()) {
+          if (auto *instr = dyn_cast<Instruction>(U.get())) {
+            Uses.push_back(IndexToBit[InstrToIndex[instr]]);
+          }
+        }
+        if (isFirstCategory(I)) {
+          Kills.push_back(IndexToBit[idx]);
+        }
+      }
+      UseBegin.push_back(Uses.size());
+      KillBegin.push_back(Kills.size());
+    }
+
+    ExtraBegin.assign(1, 0);
+    Extras.clear();
+    for (auto &list: extras) {
+      std::sort(list.begin(), list.end());
+      list.erase(std::unique(list.begin(), list.end()), list.end());
+      Extras.insert(Extras.end(), list.begin(), list.end());
+      ExtraBegin.push_back(Extras.size());
+    }
+  }
+
+  LivenessEngine Mode = LivenessEngine::Dense;
+  // bit of each instruction index (~0u for void instructions) and back
+  std::vector<unsigned> IndexToBit;
+  std::vector<unsigned> BitToIndex;
+  // Slab engine: row i is the live set on the outgoing edges of node i
+  unsigned NumWords = 0;
+  std::vector<Word> Slab;
+  // Sparse engine: the sorted live bits on the outgoing edges of node i
+  std::vector<std::vector<unsigned>> LiveBits;
+  // PredEdge[q]: position in Succs of the q-th edge in Preds
+  std::vector<unsigned> PredEdge;
+  // Uses/Kills[XBegin[i] .. XBegin[i + 1]) are the bits node i sets/resets
+  std::vector<unsigned> UseBegin, Uses;
+  std::vector<unsigned> KillBegin, Kills;
+  // Extras[ExtraBegin[e] .. ExtraBegin[e + 1]) are set on the e-th edge in Succs only
+  std::vector<unsigned> ExtraBegin, Extras;
+  // Block solver only: the use and def sets of the non-Phi instructions of each block
+  DenseMap<BasicBlock*, std::vector<unsigned>> BlockUses, BlockDefs;
+};
+
+// Solve liveness on F with the engine chosen on the command line
+LivenessAnalysis* runLivenessAnalysis(Function &F) {
+  uint size = 1;
+  for (auto &BB: F) {
+    size += BB.size();
+  }
+  LivenessInfo bottom{size};
+  LivenessInfo initState{size};
 
-    auto la = new LivenessAnalysis{bottom, initState};
+  auto la = new LivenessAnalysis{bottom, initState};
+  if (Engine == LivenessEngine::Slab) {
+    la->runSlabAlgorithm(&F);
+  } else if (Engine == LivenessEngine::Sparse) {
+    la->runSparseAlgorithm(&F);
+  } else {
+    la->setBlockSolver(BlockSolver);
     la->runWorklistAlgorithm(&F);
-    la->print();
-    delete la;
+  }
+  return la;
+}
+
+} // namespace
+
+struct LegacyLivenessPass: public ModulePass {
+  static char ID;
+  LegacyLivenessPass(): ModulePass(ID) {}
+
+  // functions are independent, analyze them concurrently
+  bool runOnModule(Module &M) override {
+    runOnFunctions(M, Threads, [](Function &F, raw_ostream &OS) {
+      auto la = runLivenessAnalysis(F);
+      la->print(OS);
+      delete la;
+    });
     // Doesn't modify the input unit of IR, hence 'false'
     return false;
   }
@@ -144,3 +598,92 @@ static RegisterPass<LegacyLivenessPass> X(
     true, // This pass doesn't modify the CFG => true
     false // This pass is not a pure analysis pass => false
 );
+
+/*
+ * Dead code elimination from the liveness results: a first category
+ * instruction whose value is not live after it is removed, as long as all
+ * its users are removed too (liveness does not see the uses by a Phi
+ * through other edges than its own, nor by returns outside the last block).
+ * Removing an instruction can make its operands dead, so liveness is solved
+ * again until nothing is removed.
+ */
+struct LegacyDCEPass: public FunctionPass {
+  static char ID;
+  LegacyDCEPass(): FunctionPass(ID) {}
+
+  bool runOnFunction(Function &F) override {
+    unsigned removed = 0, rounds = 0;
+    while (true) {
+      rounds++;
+      auto dead = findDeadInstructions(F);
+      if (dead.empty()) {
+        break;
+      }
+      // the users of each instruction are in dead as well
+      for (auto I: dead) {
+        I->replaceAllUsesWith(UndefValue::get(I->getType()));
+      }
+      for (auto I: dead) {
+        I->eraseFromParent();
+      }
+      removed += dead.size();
+    }
+    errs() << F.getName() << ": removed " << removed << " instructions in "
+           << rounds << " rounds\n";
+    return removed != 0;
+  }
+
+private:
+  std::vector<Instruction*> findDeadInstructions(Function &F) {
+    auto la = runLivenessAnalysis(F);
+    DenseSet<Instruction*> dead;
+    std::vector<Instruction*> work;
+    for (auto &I: instructions(F)) {
+      auto *load = dyn_cast<LoadInst>(&I);
+      if (isFirstCategory(&I) && !(load && !load->isSimple()) && !la->isLiveOut(&I)) {
+        dead.insert(&I);
+        work.push_back(&I);
+      }
+    }
+    delete la;
+
+    // keep the instructions with a user that stays, and then their operands
+    while (!work.empty()) {
+      auto I = work.back();
+      work.pop_back();
+      if (!dead.count(I)) {
+        continue;
+      }
+      for (auto *U: I->users()) {
+        auto *user = dyn_cast<Instruction>(U);
+        if (!user || !dead.count(user)) {
+          dead.erase(I);
+          break;
+        }
+      }
+      if (!dead.count(I)) {
+        for (auto &op: I->operands()) {
+          if (auto *instr = dyn_cast<Instruction>(op.get())) {
+            work.push_back(instr);
+          }
+        }
+      }
+    }
+
+    std::vector<Instruction*> result;
+    for (auto &I: instructions(F)) {
+      if (dead.count(&I)) {
+        result.push_back(&I);
+      }
+    }
+    return result;
+  }
+};
+
+char LegacyDCEPass::ID = 0;
+static RegisterPass<LegacyDCEPass> Y(
+    "cse231-dce",
+    "Liveness-driven Dead Code Elimination",
+    true, // This pass doesn't modify the CFG => true
+    false // This pass is not a pure analysis pass => false
+);
@@ -1,45 +1,85 @@
 
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/SparseBitVector.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/CallGraphSCCPass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/InstVisitor.h"
 
 #include "../DFA/231DFA.h"
+#include "../DFA/231Driver.h"
+#include <algorithm>
 #include <map>
 #include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 namespace {
 using namespace llvm;
-using Identifier = std::pair<char, uint>;
-using Data = std::map<Identifier, std::set<uint>>;
+// the indices of the allocas a node may point to
+using PointsTo = SparseBitVector<>;
 
+cl::opt<unsigned> Threads("cse231-maypointto-threads",
+    cl::desc("Number of threads analyzing functions (0: one per hardware thread)"),
+    cl::init(1));
+
+/*
+ * Nodes are numbered densely by instruction index: the memory node M of an
+ * alloca is its index, the register node R of a pointer is its index + RBase.
+ * The facts are kept sorted by node, i.e. all M nodes before all R nodes as
+ * they are printed, and a node without targets has no entry at all.
+ */
 struct MayPointToInfo: Info {
+  static constexpr unsigned RBase = 1u << 31;
+  static unsigned mNode(unsigned idx) { return idx; }
+  static unsigned rNode(unsigned idx) { return RBase + idx; }
+
   MayPointToInfo() = default;
   MayPointToInfo(const MayPointToInfo& other) {
     data = other.data;
   }
   ~MayPointToInfo() override = default;
 
-  void print() override {
+  void print(raw_ostream &OS) override {
     for (auto &kv: data) {
-      if (kv.second.empty())
-        continue;
-      errs() << kv.first.first << kv.first.second << "->(";
+      OS << (kv.first < RBase ? 'M' : 'R') << (kv.first & ~RBase) << "->(";
       for (auto m: kv.second) {
-        errs() << "M" << m << "/";
+        OS << "M" << m << "/";
       }
-      errs() << ")|";
+      OS << ")|";
     }
-    errs() << "\n";
+    OS << "\n";
   }
 
-  void insert(Identifier id, uint m) {
-    data[id].insert(m);
+  // The targets of node id, or nullptr if it has none. Never adds an entry.
+  const PointsTo* lookup(unsigned id) const {
+    auto it = find(id);
+    return it != data.end() && it->first == id ? &it->second : nullptr;
   }
 
-  void insert(Identifier id, std::set<uint> ms) {
-    data[id].insert(ms.begin(), ms.end());
+  void insert(unsigned id, unsigned m) {
+    auto it = find(id);
+    if (it == data.end() || it->first != id)
+      it = data.insert(it, {id, PointsTo()});
+    it->second.set(m);
+  }
+
+  // Union ms into the targets of id in place; ms must not belong to this Info
+  void insert(unsigned id, const PointsTo& ms) {
+    if (ms.empty())
+      return;
+    auto it = find(id);
+    if (it == data.end() || it->first != id)
+      data.insert(it, {id, ms});
+    else
+      it->second |= ms;
   }
 
-  std::set<uint>& operator[](Identifier id) { return data[id]; }
   void clear() { data.clear(); }
 
   static bool equals(MayPointToInfo* lhs, MayPointToInfo* rhs) {
@@ -47,128 +87,787 @@ struct MayPointToInfo: Info {
   }
 
   MayPointToInfo& join(const MayPointToInfo& other) {
+    if (data.empty()) {
+      data = other.data;
+      return *this;
+    }
+    // both sides are sorted, so each search starts after the previous node
+    auto it = data.begin();
     for (auto &kv: other.data) {
-      insert(kv.first, kv.second);
+      it = std::lower_bound(it, data.end(), kv.first,
+                            [](const Fact& f, unsigned id) { return f.first < id; });
+      if (it != data.end() && it->first == kv.first)
+        it->second |= kv.second;
+      else
+        it = data.insert(it, kv);
+      ++it;
     }
+    return *this;
   }
 private:
-  Data data;
+  using Fact = std::pair<unsigned, PointsTo>;
+
+  std::vector<Fact>::iterator find(unsigned id) {
+    return std::lower_bound(data.begin(), data.end(), id,
+                            [](const Fact& f, unsigned id) { return f.first < id; });
+  }
+  std::vector<Fact>::const_iterator find(unsigned id) const {
+    return const_cast<MayPointToInfo*>(this)->find(id);
+  }
+
+  std::vector<Fact> data;
+};
+
+/*
+ * An object of a summary, relative to a root: the i-th argument or the
+ * global with id i. At level 0 it is the object the root points to (P_i, or
+ * the global itself), at level 1 what that object points to at the entry of
+ * the callee, and at level 2 anything reachable from those.
+ */
+struct SummaryObject {
+  bool Global;
+  unsigned Root;
+  unsigned Level;
+
+  bool operator<(const SummaryObject& other) const {
+    return std::tie(Global, Root, Level) < std::tie(other.Global, other.Root, other.Level);
+  }
+  bool operator==(const SummaryObject& other) const {
+    return Global == other.Global && Root == other.Root && Level == other.Level;
+  }
 };
 
+/*
+ * The effect of a call on the may-point-to facts of the caller, in terms of
+ * the summary objects, which the caller maps to its own facts at the call.
+ * The summary assumes its objects are distinct, so a call where two of them
+ * stand for a common object, as with f(p, p), does not use it.
+ */
+struct MayPointToSummary {
+  // (x, y): the callee may store a pointer to y into x
+  std::set<std::pair<SummaryObject, SummaryObject>> Stores;
+  // the returned pointer may point to these
+  std::set<SummaryObject> Returns;
+
+  bool operator==(const MayPointToSummary& other) const {
+    return Stores == other.Stores && Returns == other.Returns;
+  }
+  bool operator!=(const MayPointToSummary& other) const { return !(*this == other); }
+};
+using SummaryMap = DenseMap<Function*, MayPointToSummary>;
+using GlobalIDMap = DenseMap<const GlobalVariable*, unsigned>;
+
 struct MayPointToAnalysis: DataFlowAnalysis<MayPointToInfo, true>,
                            InstVisitor<MayPointToAnalysis> {
   MayPointToAnalysis(MayPointToInfo bottom, MayPointToInfo initState)
    : DataFlowAnalysis(bottom, initState) {}
   ~MayPointToAnalysis() override {}
 
+  /*
+   * Apply the summaries of the callees at calls. The summary objects of the
+   * analyzed function then get the indices after its N nodes: the object at
+   * level l of the i-th of its A arguments is N + l * A + i, and that of the
+   * global with id g is N + 3 * A + 3 * g + l. The register of a root has the
+   * index of its level 0 object, and entryState says what the roots point to.
+   */
+  void setSummaries(const SummaryMap* summaries, const GlobalIDMap* globalIDs) {
+    Summaries = summaries;
+    GlobalIDs = globalIDs;
+  }
+
+  /*
+   * The initial state with summaries: each level of a root points to the
+   * next one, and level 2 to itself. The roots are the arguments and the
+   * globals F uses directly or through the summaries of its callees.
+   */
+  static MayPointToInfo entryState(Function &F, const SummaryMap& summaries,
+                                   const GlobalIDMap& globalIDs) {
+    std::set<unsigned> globals;
+    for (auto &I: instructions(F)) {
+      for (auto &op: I.operands()) {
+        if (auto *G = dyn_cast<GlobalVariable>(op.get()->stripInBoundsConstantOffsets()))
+          globals.insert(globalIDs.lookup(G));
+      }
+      auto call = dyn_cast<CallInst>(&I);
+      auto it = call && call->getCalledFunction() ? summaries.find(call->getCalledFunction())
+                                                  : summaries.end();
+      if (it == summaries.end())
+        continue;
+      for (auto &store: it->second.Stores) {
+        for (auto &object: {store.first, store.second}) {
+          if (object.Global)
+            globals.insert(object.Root);
+        }
+      }
+      for (auto &object: it->second.Returns) {
+        if (object.Global)
+          globals.insert(object.Root);
+      }
+    }
+
+    unsigned first = 1;
+    for (auto &BB: F) {
+      first += BB.size();
+    }
+    MayPointToInfo state;
+    auto addRoot = [&](bool global, unsigned root) {
+      SummaryObject object{global, root, 0};
+      unsigned level0 = objectIndex(first, F.arg_size(), object);
+      object.Level = 1;
+      unsigned level1 = objectIndex(first, F.arg_size(), object);
+      object.Level = 2;
+      unsigned level2 = objectIndex(first, F.arg_size(), object);
+      state.insert(MayPointToInfo::rNode(level0), level0);
+      state.insert(MayPointToInfo::mNode(level0), level1);
+      state.insert(MayPointToInfo::mNode(level1), level2);
+      state.insert(MayPointToInfo::mNode(level2), level2);
+    };
+    for (unsigned i = 0; i < F.arg_size(); ++i) {
+      addRoot(false, i);
+    }
+    for (auto g: globals) {
+      addRoot(true, g);
+    }
+    return state;
+  }
+
+  /*
+   * The summary of the analyzed function: the stores into summary objects
+   * that its stores and calls may do, and what reaches its returns
+   */
+  MayPointToSummary summarize(Function &F) {
+    if (!Materialized)
+      materialize();
+    MayPointToSummary summary;
+    summary.Stores = SummaryStores;
+
+    for (unsigned idx = 1; idx < First; ++idx) {
+      auto ret = dyn_cast<ReturnInst>(IndexToInstr[idx]);
+      unsigned r;
+      if (ret == nullptr || ret->getReturnValue() == nullptr || !lookupReg(ret->getReturnValue(), r))
+        continue;
+      auto exit = getInfoBefore(ret);
+      if (auto *X = exit.lookup(MayPointToInfo::rNode(r))) {
+        for (auto x: *X) {
+          SummaryObject object;
+          if (summaryObject(x, object))
+            summary.Returns.insert(object);
+        }
+      }
+    }
+    return summary;
+  }
+
+  // The facts joined over the incoming edges of I, those that hold before it
+  MayPointToInfo getInfoBefore(Instruction *I) {
+    if (!Materialized)
+      materialize();
+    MayPointToInfo result;
+    std::vector<unsigned> incomingEdges;
+    unsigned idx = InstrToIndex.lookup(I);
+    getIncomingEdges(idx, &incomingEdges);
+    for (auto i: incomingEdges) {
+      result.join(*EdgeToInfo.at({i, idx}));
+    }
+    return result;
+  }
+
+  /*
+   * The visitors read the joined facts from in and add the new facts to out,
+   * which starts as a copy of in. Reading and writing different objects lets
+   * them union the target sets in place without copying them first.
+   */
   void visitAllocaInst(AllocaInst &I) {
-    auto idx = InstrToIndex[&I];
-    in.insert({'R', idx}, idx);
+    auto idx = InstrToIndex.lookup(&I);
+    out->insert(MayPointToInfo::rNode(idx), idx);
   }
   void visitBitCastInst(BitCastInst &I) {
-    auto idx = InstrToIndex[&I];
-    auto op = I.getOperand(0);
-    if (auto *instr = dyn_cast<Instruction>(op)) {
-      auto X = in[{'R', InstrToIndex[instr]}];
-      in.insert({'R', idx}, X);
+    auto idx = InstrToIndex.lookup(&I);
+    unsigned op;
+    if (lookupReg(I.getOperand(0), op)) {
+      addTargets(MayPointToInfo::rNode(idx), MayPointToInfo::rNode(op));
     }
   }
   void visitGetElementPtrInst(GetElementPtrInst &I) {
-    auto idx = InstrToIndex[&I];
-    auto ptr = I.getPointerOperand();
-    if (auto *instr = dyn_cast<Instruction>(ptr)) {
-      auto X = in[{'R', InstrToIndex[instr]}];
-      in.insert({'R', idx}, X);
+    auto idx = InstrToIndex.lookup(&I);
+    unsigned ptr;
+    if (lookupReg(I.getPointerOperand(), ptr)) {
+      addTargets(MayPointToInfo::rNode(idx), MayPointToInfo::rNode(ptr));
     }
   }
   void visitLoadInst(LoadInst &I) {
-    auto idx = InstrToIndex[&I];
-    auto value = I.getPointerOperand();
-    if (auto *rp = dyn_cast<Instruction>(value)) {
-      auto X = in[{'R', InstrToIndex[rp]}];
-      for (auto x: X) {
-        auto Y = in[{'M', x}];
-        in.insert({'R', idx}, Y);
+    auto idx = InstrToIndex.lookup(&I);
+    unsigned rp;
+    if (lookupReg(I.getPointerOperand(), rp)) {
+      if (auto *X = in.lookup(MayPointToInfo::rNode(rp))) {
+        for (auto x: *X) {
+          addTargets(MayPointToInfo::rNode(idx), MayPointToInfo::mNode(x));
+        }
       }
     }
   }
   void visitStoreInst(StoreInst &I) {
-    auto idx = InstrToIndex[&I];
-    auto *rv = dyn_cast<Instruction>(I.getValueOperand());
-    auto *rp = dyn_cast<Instruction>(I.getPointerOperand());
-    if (rv && rp) {
-      auto X = in[{'R', InstrToIndex[rv]}];
-      auto Y = in[{'R', InstrToIndex[rp]}];
-      for (auto x: X) {
-        for (auto y: Y) {
-          in.insert({'M', y}, x);
-        }
+    unsigned rv, rp;
+    if (lookupReg(I.getValueOperand(), rv) && lookupReg(I.getPointerOperand(), rp)) {
+      auto X = in.lookup(MayPointToInfo::rNode(rv));
+      auto Y = in.lookup(MayPointToInfo::rNode(rp));
+      if (X && Y) {
+        storeTargets(*Y, *X);
       }
     }
   }
   void visitSelectInst(SelectInst &I) {
-    auto idx = InstrToIndex[&I];
+    auto idx = InstrToIndex.lookup(&I);
     for (auto &op: I.operands()) {
-      if (auto *ri = dyn_cast<Instruction>(op.get())) {
-        auto X = in[{'R', InstrToIndex[ri]}];
-        in.insert({'R', idx}, X);
+      unsigned ri;
+      if (lookupReg(op.get(), ri)) {
+        addTargets(MayPointToInfo::rNode(idx), MayPointToInfo::rNode(ri));
       }
     }
   }
   void visitPHINode(PHINode &I) {
-    auto idx = InstrToIndex[&I];
+    auto idx = InstrToIndex.lookup(&I);
     
     auto BB = I.getParent();
     auto end = BB->getFirstNonPHI();
     // iter over consecutive Phi instructions
     for (auto ii = BB->begin(); &*ii != end; ++ii) {
       for (auto &op: I.operands()) {
-        if (auto *ri = dyn_cast<Instruction>(op.get())) {
-          auto X = in[{'R', InstrToIndex[ri]}];
-          in.insert({'R', idx}, X);
+        unsigned ri;
+        if (lookupReg(op.get(), ri)) {
+          addTargets(MayPointToInfo::rNode(idx), MayPointToInfo::rNode(ri));
         }
       }
     }
   }
+  void visitCallInst(CallInst &I) {
+    auto callee = I.getCalledFunction();
+    if (Summaries == nullptr || callee == nullptr)
+      return;
+    auto it = Summaries->find(callee);
+    if (it == Summaries->end())
+      return;
+
+    // the summary objects in terms of the facts of the caller, mapped once
+    std::map<SummaryObject, PointsTo> actuals;
+    auto idx = InstrToIndex.lookup(&I);
+    PointsTo reachable;
+    if (aliasedObjects(I, it->second, actuals, reachable)) {
+      // anything reachable from the actuals may point to any of it
+      storeTargets(reachable, reachable);
+      if (!it->second.Returns.empty())
+        out->insert(MayPointToInfo::rNode(idx), reachable);
+      return;
+    }
+    for (auto &store: it->second.Stores) {
+      auto &X = actualObjects(I, store.second, actuals);
+      auto &Y = actualObjects(I, store.first, actuals);
+      storeTargets(Y, X);
+    }
+    for (auto &object: it->second.Returns) {
+      out->insert(MayPointToInfo::rNode(idx), actualObjects(I, object, actuals));
+    }
+  }
   void visitInstruction(Instruction &I) {
     // out = in, do nothing
   }
 
 private:
+  void prepare(Function* F) override {
+    First = IndexToInstr.size();
+    NumArgs = F->arg_size();
+  }
+
+  // The node of a summary object in a function with First and NumArgs
+  static unsigned objectIndex(unsigned first, unsigned numArgs, const SummaryObject& object) {
+    if (object.Global)
+      return first + 3 * numArgs + 3 * object.Root + object.Level;
+    return first + object.Level * numArgs + object.Root;
+  }
+
+  // The summary object of node idx of the analyzed function, if it is one
+  bool summaryObject(unsigned idx, SummaryObject& object) const {
+    if (Summaries == nullptr || idx < First)
+      return false;
+    idx -= First;
+    if (idx < 3 * NumArgs)
+      object = {false, idx % NumArgs, idx / NumArgs};
+    else
+      object = {true, (idx - 3 * NumArgs) / 3, (idx - 3 * NumArgs) % 3};
+    return true;
+  }
+
+  /*
+   * What a summary object of the callee stands for at Call: the targets of
+   * the argument, or the global itself, at level 0, their targets at level 1
+   * and everything those reach at level 2. Cached in Actuals.
+   */
+  const PointsTo& actualObjects(CallInst& Call, const SummaryObject& object,
+                                std::map<SummaryObject, PointsTo>& actuals) {
+    auto it = actuals.find(object);
+    if (it != actuals.end())
+      return it->second;
+    PointsTo result;
+    if (object.Level == 0 && object.Global) {
+      result.set(objectIndex(First, NumArgs, object));
+    } else if (object.Level == 0) {
+      unsigned r;
+      if (object.Root < Call.arg_size() && lookupReg(Call.getArgOperand(object.Root), r)) {
+        if (auto *X = in.lookup(MayPointToInfo::rNode(r)))
+          result = *X;
+      }
+    } else {
+      PointsTo pending = actualObjects(Call, {object.Global, object.Root, object.Level - 1}, actuals);
+      while (!pending.empty()) {
+        PointsTo next;
+        for (auto x: pending) {
+          if (auto *X = in.lookup(MayPointToInfo::mNode(x)))
+            next |= *X;
+        }
+        next.intersectWithComplement(result);
+        result |= next;
+        if (object.Level == 1)
+          break;
+        pending = next;
+      }
+    }
+    return actuals[object] = result;
+  }
+
+  /*
+   * Whether two objects of Summary, over the arguments of Call and the
+   * globals it names, stand for a common object at Call. Reachable gets
+   * all the objects they stand for.
+   */
+  bool aliasedObjects(CallInst& Call, const MayPointToSummary& Summary,
+                      std::map<SummaryObject, PointsTo>& actuals, PointsTo& Reachable) {
+    std::set<SummaryObject> roots;
+    for (unsigned i = 0; i < Call.getCalledFunction()->arg_size(); ++i) {
+      roots.insert({false, i, 0});
+    }
+    for (auto &store: Summary.Stores) {
+      for (auto &object: {store.first, store.second}) {
+        if (object.Global)
+          roots.insert({true, object.Root, 0});
+      }
+    }
+    for (auto &object: Summary.Returns) {
+      if (object.Global)
+        roots.insert({true, object.Root, 0});
+    }
+    bool aliased = false;
+    for (auto root: roots) {
+      for (root.Level = 0; root.Level < 3; ++root.Level) {
+        auto &objects = actualObjects(Call, root, actuals);
+        aliased |= Reachable.intersects(objects);
+        Reachable |= objects;
+      }
+    }
+    return aliased;
+  }
+
+  /*
+   * Every object of Y may now point to X. With summaries, the stores from a
+   * summary object into one are recorded for summarize.
+   */
+  void storeTargets(const PointsTo& Y, const PointsTo& X) {
+    if (X.empty())
+      return;
+    for (auto y: Y) {
+      out->insert(MayPointToInfo::mNode(y), X);
+      SummaryObject target, value;
+      if (!summaryObject(y, target))
+        continue;
+      for (auto x: X) {
+        if (summaryObject(x, value))
+          SummaryStores.insert({target, value});
+      }
+    }
+  }
+
   void flowfunction(Instruction* I, std::vector<unsigned>& IncomingEdges,
                     std::vector<unsigned>& OutgoingEdges, std::vector<MayPointToInfo*>& Infos) override {
-    unsigned cur = InstrToIndex.at(I);
+    unsigned cur = InstrToIndex.lookup(I);
 
     for (auto &i: IncomingEdges) {
       in.join(*(EdgeToInfo.at({i, cur})));
     }
 
+    out = newInfo(in);
     visit(*I);
-    
-    for (size_t i = 0; i < OutgoingEdges.size(); ++i) {
-      Infos.push_back(new MayPointToInfo(in));
-    }
+
+    // all outgoing edges share out
+    Infos.assign(OutgoingEdges.size(), out);
     in.clear();
   }
 
+  // The register index of an instruction, or of a root when calls are summarized
+  bool lookupReg(Value* v, unsigned& idx) {
+    if (auto *instr = dyn_cast<Instruction>(v)) {
+      idx = InstrToIndex.lookup(instr);
+      return true;
+    }
+    if (Summaries == nullptr)
+      return false;
+    if (auto *arg = dyn_cast<Argument>(v)) {
+      idx = objectIndex(First, NumArgs, {false, arg->getArgNo(), 0});
+      return true;
+    }
+    if (auto *G = dyn_cast<GlobalVariable>(v->stripInBoundsConstantOffsets())) {
+      idx = objectIndex(First, NumArgs, {true, GlobalIDs->lookup(G), 0});
+      return true;
+    }
+    return false;
+  }
+
+  // out(dst) ∪= in(src)
+  void addTargets(unsigned dst, unsigned src) {
+    if (auto *X = in.lookup(src))
+      out->insert(dst, *X);
+  }
+
   MayPointToInfo in;
+  MayPointToInfo* out = nullptr;
+  const SummaryMap* Summaries = nullptr;
+  const GlobalIDMap* GlobalIDs = nullptr;
+  // the first summary object and the number of arguments
+  unsigned First = 0, NumArgs = 0;
+  std::set<std::pair<SummaryObject, SummaryObject>> SummaryStores;
 };
 
-} // namespace
+/*
+ * Reaching definitions of memory, for store-to-load forwarding.
+ * ReachingDefinitionAnalysis only defines SSA values, so here a definition
+ * is a store that may write one of the tracked allocas, or the entry of the
+ * function, which leaves each of them uninitialized. A store to the alloca
+ * itself kills its other definitions; a store through a pointer that only
+ * may point to it kills none.
+ */
+struct StoreDef {
+  // the store, or nullptr for the entry
+  StoreInst* Store;
+  // the tracked alloca it may write
+  unsigned Object;
+  // whether it writes the whole alloca for sure
+  bool Must;
+};
 
-struct LegacyMayPointToPass: public FunctionPass {
-  static char ID;
-  LegacyMayPointToPass(): FunctionPass(ID) {}
+struct ReachingStoreInfo: Info {
+  ReachingStoreInfo() = default;
+  ReachingStoreInfo(unsigned n): defs(n) {}
+  ReachingStoreInfo(const ReachingStoreInfo& other) {
+    defs = other.defs;
+  }
+  ~ReachingStoreInfo() override = default;
 
-  bool runOnFunction(Function &F) override {
+  void print(raw_ostream &OS) override {
+    for (unsigned d: defs.set_bits())
+      OS << d << '|';
+    OS << '\n';
+  }
+
+  static bool equals(ReachingStoreInfo* lhs, ReachingStoreInfo* rhs) {
+    return lhs->defs == rhs->defs;
+  }
+
+  // one bit per StoreDef
+  BitVector defs;
+};
+
+struct ReachingStoreAnalysis: DataFlowAnalysis<ReachingStoreInfo, true> {
+  /*
+   * Defs are the definitions, ObjectDefs[o] the definitions of the alloca o
+   * and Writes the definitions of each store, in increasing order.
+   */
+  ReachingStoreAnalysis(ReachingStoreInfo bottom, ReachingStoreInfo initState,
+                        const std::vector<StoreDef>& defs,
+                        const std::vector<BitVector>& objectDefs,
+                        const DenseMap<Instruction*, std::vector<unsigned>>& writes)
+    : DataFlowAnalysis(bottom, initState), Defs(defs), ObjectDefs(objectDefs), Writes(writes) {}
+  ~ReachingStoreAnalysis() override {}
+
+  // The definitions of alloca o reaching I
+  BitVector getReachingDefs(Instruction* I, unsigned o) {
+    BitVector result(Defs.size());
+    std::vector<unsigned> incomingEdges;
+    unsigned idx = InstrToIndex.lookup(I);
+    getIncomingEdges(idx, &incomingEdges);
+    for (auto i: incomingEdges) {
+      result |= EdgeToInfo.at({i, idx})->defs;
+    }
+    return result &= ObjectDefs[o];
+  }
+
+private:
+  void flowfunction(Instruction* I, std::vector<unsigned>& IncomingEdges,
+                    std::vector<unsigned>& OutgoingEdges, std::vector<ReachingStoreInfo*>& Infos) override {
+    unsigned cur = InstrToIndex.lookup(I);
+
+    auto out = newInfo(Bottom);
+    for (auto &i: IncomingEdges) {
+      out->defs |= EdgeToInfo.at({i, cur})->defs;
+    }
+    auto it = Writes.find(I);
+    if (it != Writes.end()) {
+      for (auto d: it->second) {
+        if (Defs[d].Must)
+          out->defs.reset(ObjectDefs[Defs[d].Object]);
+        out->defs.set(d);
+      }
+    }
+    // all n outgoing edges share one copy of out
+    Infos.assign(OutgoingEdges.size(), out);
+  }
+
+  const std::vector<StoreDef>& Defs;
+  const std::vector<BitVector>& ObjectDefs;
+  const DenseMap<Instruction*, std::vector<unsigned>>& Writes;
+};
+
+/*
+ * Forward stored values to the loads of the same alloca. Only the static
+ * allocas whose address does not escape are tracked: every pointer to them
+ * is then a register the may-point-to facts follow, so the stores that may
+ * write them are known and calls cannot touch them. A load is replaced when
+ * all the definitions reaching it are stores to the alloca itself of one
+ * value available there. An alloca left with stores only is then removed.
+ */
+struct StoreForwarding {
+  explicit StoreForwarding(Function &F): F(F), DT(F) {}
+
+  bool run() {
     MayPointToInfo bottom{};
     MayPointToInfo initState{};
-    
-    auto mpt = new MayPointToAnalysis(bottom, initState);
-    mpt->runWorklistAlgorithm(&F);
-    mpt->print();
-    
-    delete mpt;
+    MayPointToAnalysis mpt(bottom, initState);
+    mpt.runWorklistAlgorithm(&F);
+
+    unsigned counter = 1;
+    for (auto &I: instructions(F)) {
+      InstrToIndex[&I] = counter++;
+    }
+    // the facts before I, the leading Phi standing for the others
+    auto factsBefore = [&](Instruction &I) {
+      return mpt.getInfoBefore(isa<PHINode>(I) ? &I.getParent()->front() : &I);
+    };
+    auto targets = [&](const MayPointToInfo& facts, Value* v) -> const PointsTo* {
+      auto *instr = dyn_cast<Instruction>(v);
+      return instr ? facts.lookup(MayPointToInfo::rNode(InstrToIndex.lookup(instr))) : nullptr;
+    };
+
+    findEscaped(factsBefore, targets);
+    for (auto &I: instructions(F)) {
+      auto *alloca = dyn_cast<AllocaInst>(&I);
+      if (alloca && alloca->isStaticAlloca() && !Escaped.test(InstrToIndex.lookup(alloca))) {
+        ObjectOf[InstrToIndex.lookup(alloca)] = Objects.size();
+        Objects.push_back(alloca);
+      }
+    }
+    if (Objects.empty())
+      return false;
+
+    findDefs(factsBefore, targets);
+    forwardLoads();
+    removeDeadAllocas();
+    return NumLoads != 0 || NumStores != 0 || NumAllocas != 0;
+  }
+
+  unsigned NumLoads = 0, NumStores = 0, NumAllocas = 0;
+
+private:
+  /*
+   * An alloca escapes when a register that may point to it is used other
+   * than as the may-point-to rules model, or is stored to memory that is not
+   * a tracked alloca or that escapes itself.
+   */
+  template <class Facts, class Targets>
+  void findEscaped(Facts factsBefore, Targets targets) {
+    Escaped.resize(InstrToIndex.size() + 1);
+    // (what is stored, where it is stored), nowhere known being empty
+    std::vector<std::pair<PointsTo, PointsTo>> stored;
+
+    for (auto &I: instructions(F)) {
+      if (std::none_of(I.op_begin(), I.op_end(), [](Use &U) { return isa<Instruction>(U.get()); }))
+        continue;
+      auto facts = factsBefore(I);
+      for (auto &U: I.operands()) {
+        auto X = targets(facts, U.get());
+        if (X == nullptr || isModeled(I, U.getOperandNo()))
+          continue;
+        auto *store = dyn_cast<StoreInst>(&I);
+        if (store && U.getOperandNo() == 0) {
+          auto Y = targets(facts, store->getPointerOperand());
+          stored.push_back({*X, Y ? *Y : PointsTo()});
+          continue;
+        }
+        for (auto x: *X) {
+          Escaped.set(x);
+        }
+      }
+    }
+
+    for (bool changed = true; changed; ) {
+      changed = false;
+      for (auto &s: stored) {
+        bool escapes = s.second.empty();
+        for (auto y: s.second) {
+          escapes |= Escaped.test(y);
+        }
+        if (!escapes)
+          continue;
+        for (auto x: s.first) {
+          changed |= !Escaped.test(x);
+          Escaped.set(x);
+        }
+      }
+    }
+  }
+
+  // Whether the may-point-to rules follow operand i of I, or it cannot leak a pointer
+  static bool isModeled(Instruction &I, unsigned i) {
+    if (isa<LoadInst>(I) || isa<BitCastInst>(I) || isa<GetElementPtrInst>(I))
+      return i == 0;
+    if (isa<StoreInst>(I))
+      return i == 1;
+    if (isa<SelectInst>(I))
+      return i != 0;
+    if (isa<PHINode>(I))
+      return &I == &I.getParent()->front();
+    return isa<ICmpInst>(I);
+  }
+
+  template <class Facts, class Targets>
+  void findDefs(Facts factsBefore, Targets targets) {
+    for (unsigned o = 0; o < Objects.size(); ++o) {
+      Defs.push_back({nullptr, o, false});
+    }
+    for (auto &I: instructions(F)) {
+      auto *store = dyn_cast<StoreInst>(&I);
+      if (store == nullptr)
+        continue;
+      auto facts = factsBefore(I);
+      auto Y = targets(facts, store->getPointerOperand());
+      if (Y == nullptr)
+        continue;
+      for (auto y: *Y) {
+        auto it = ObjectOf.find(y);
+        if (it == ObjectOf.end())
+          continue;
+        auto *alloca = Objects[it->second];
+        bool must = store->getPointerOperand() == alloca && store->isSimple() &&
+                    store->getValueOperand()->getType() == alloca->getAllocatedType();
+        Writes[store].push_back(Defs.size());
+        Defs.push_back({store, it->second, must});
+      }
+    }
+    ObjectDefs.assign(Objects.size(), BitVector(Defs.size()));
+    for (unsigned d = 0; d < Defs.size(); ++d) {
+      ObjectDefs[Defs[d].Object].set(d);
+    }
+  }
+
+  void forwardLoads() {
+    // the loads of tracked allocas and the alloca each reads
+    std::vector<std::pair<LoadInst*, unsigned>> loads;
+    for (auto &I: instructions(F)) {
+      auto *load = dyn_cast<LoadInst>(&I);
+      if (load == nullptr || !load->isSimple())
+        continue;
+      auto *alloca = dyn_cast<AllocaInst>(load->getPointerOperand());
+      auto it = alloca ? ObjectOf.find(InstrToIndex.lookup(alloca)) : ObjectOf.end();
+      if (it != ObjectOf.end() && load->getType() == alloca->getAllocatedType())
+        loads.push_back({load, it->second});
+    }
+    if (loads.empty())
+      return;
+
+    ReachingStoreInfo bottom{(unsigned)Defs.size()};
+    ReachingStoreInfo initState{(unsigned)Defs.size()};
+    for (unsigned o = 0; o < Objects.size(); ++o) {
+      initState.defs.set(o);
+    }
+    ReachingStoreAnalysis rsa(bottom, initState, Defs, ObjectDefs, Writes);
+    rsa.runWorklistAlgorithm(&F);
+
+    // the stores reaching each load, all read before the IR changes
+    std::vector<std::pair<LoadInst*, std::vector<StoreInst*>>> forwards;
+    for (auto &l: loads) {
+      auto reaching = rsa.getReachingDefs(l.first, l.second);
+      std::vector<StoreInst*> stores;
+      for (auto d: reaching.set_bits()) {
+        if (!Defs[d].Must) {
+          stores.clear();
+          break;
+        }
+        stores.push_back(Defs[d].Store);
+      }
+      if (!stores.empty())
+        forwards.push_back({l.first, std::move(stores)});
+    }
+
+    // a stored value may be a load forwarded before, so read it only now
+    for (auto &f: forwards) {
+      auto *load = f.first;
+      auto *value = f.second.front()->getValueOperand();
+      bool same = std::all_of(f.second.begin(), f.second.end(),
+                              [&](StoreInst* s) { return s->getValueOperand() == value; });
+      auto *instr = dyn_cast<Instruction>(value);
+      if (!same || value == load || (instr && !DT.dominates(instr, load)))
+        continue;
+      load->replaceAllUsesWith(value);
+      load->eraseFromParent();
+      NumLoads++;
+    }
+  }
+
+  void removeDeadAllocas() {
+    for (auto *alloca: Objects) {
+      bool onlyStored = std::all_of(alloca->user_begin(), alloca->user_end(), [&](User* U) {
+        auto *store = dyn_cast<StoreInst>(U);
+        return store && store->isSimple() && store->getPointerOperand() == alloca &&
+               store->getValueOperand() != alloca;
+      });
+      if (!onlyStored)
+        continue;
+      while (!alloca->use_empty()) {
+        cast<Instruction>(alloca->user_back())->eraseFromParent();
+        NumStores++;
+      }
+      alloca->eraseFromParent();
+      NumAllocas++;
+    }
+  }
+
+  Function &F;
+  DominatorTree DT;
+  DenseMap<Instruction*, unsigned> InstrToIndex;
+  // the allocas that may be pointed to outside the registers, by index
+  BitVector Escaped;
+  // the tracked allocas, and the position of each of them by index
+  std::vector<AllocaInst*> Objects;
+  DenseMap<unsigned, unsigned> ObjectOf;
+  std::vector<StoreDef> Defs;
+  std::vector<BitVector> ObjectDefs;
+  DenseMap<Instruction*, std::vector<unsigned>> Writes;
+};
+
+} // namespace
+
+struct LegacyMayPointToPass: public ModulePass {
+  static char ID;
+  LegacyMayPointToPass(): ModulePass(ID) {}
+
+  // functions are independent, analyze them concurrently
+  bool runOnModule(Module &M) override {
+    runOnFunctions(M, Threads, [](Function &F, raw_ostream &OS) {
+      MayPointToInfo bottom{};
+      MayPointToInfo initState{};
+
+      auto mpt = new MayPointToAnalysis(bottom, initState);
+      mpt->runWorklistAlgorithm(&F);
+      mpt->print(OS);
+
+      delete mpt;
+    });
     // Doesn't modify the input unit of IR, hence 'false'
     return false;
   }
@@ -181,3 +880,116 @@ static RegisterPass<LegacyMayPointToPass> X(
     true, // This pass doesn't modify the CFG => true
     false // This pass is not a pure analysis pass => false
 );
+
+/*
+ * Interprocedural may-point-to: the SCCs of the call graph are analyzed
+ * bottom-up and the summary of each function is applied at its calls.
+ * A function is analyzed again only when the summary of a callee in its own
+ * (recursive) SCC changes. Unlike the intraprocedural analysis, the
+ * arguments and the globals are roots of summary objects (see
+ * SummaryObject), so their effects carry over calls too.
+ */
+struct LegacyInterMayPointToPass: public CallGraphSCCPass {
+  static char ID;
+  LegacyInterMayPointToPass(): CallGraphSCCPass(ID) {}
+
+  bool runOnSCC(CallGraphSCC &SCC) override {
+    std::vector<Function*> funcs;
+    for (auto node: SCC) {
+      auto F = node->getFunction();
+      if (F && !F->isDeclaration())
+        funcs.push_back(F);
+    }
+    // the callers of each function inside the SCC
+    DenseMap<Function*, std::vector<Function*>> callers;
+    for (auto node: SCC) {
+      for (auto &record: *node) {
+        auto callee = record.second->getFunction();
+        if (std::find(funcs.begin(), funcs.end(), callee) != funcs.end())
+          callers[callee].push_back(node->getFunction());
+      }
+    }
+
+    std::set<Function*> dirty(funcs.begin(), funcs.end());
+    while (!dirty.empty()) {
+      for (auto F: funcs) {
+        if (!dirty.erase(F))
+          continue;
+        auto summary = analyze(*F);
+        if (summary != Summaries[F]) {
+          Summaries[F] = summary;
+          dirty.insert(callers[F].begin(), callers[F].end());
+        }
+      }
+    }
+    return false;
+  }
+
+  bool doInitialization(CallGraph &CG) override {
+    for (auto &G: CG.getModule().globals()) {
+      unsigned id = GlobalIDs.size();
+      GlobalIDs[&G] = id;
+    }
+    return false;
+  }
+
+  // print in the order of the module, as the intraprocedural pass
+  bool doFinalization(CallGraph &CG) override {
+    for (auto &F: CG.getModule()) {
+      auto it = Output.find(&F);
+      if (it != Output.end())
+        errs() << it->second;
+    }
+    return false;
+  }
+
+private:
+  MayPointToSummary analyze(Function &F) {
+    MayPointToInfo bottom{};
+    MayPointToInfo initState = MayPointToAnalysis::entryState(F, Summaries, GlobalIDs);
+
+    MayPointToAnalysis mpt(bottom, initState);
+    mpt.setSummaries(&Summaries, &GlobalIDs);
+    mpt.runWorklistAlgorithm(&F);
+
+    auto &out = Output[&F];
+    out.clear();
+    raw_string_ostream OS(out);
+    mpt.print(OS);
+    OS.flush();
+    return mpt.summarize(F);
+  }
+
+  SummaryMap Summaries;
+  GlobalIDMap GlobalIDs;
+  DenseMap<Function*, std::string> Output;
+};
+
+char LegacyInterMayPointToPass::ID = 0;
+static RegisterPass<LegacyInterMayPointToPass> Y(
+    "cse231-maypointto-inter",
+    "Interprocedural May-point-to Analysis",
+    true, // This pass doesn't modify the CFG => true
+    false // This pass is not a pure analysis pass => false
+);
+
+struct LegacyStoreForwardingPass: public FunctionPass {
+  static char ID;
+  LegacyStoreForwardingPass(): FunctionPass(ID) {}
+
+  bool runOnFunction(Function &F) override {
+    StoreForwarding sf(F);
+    bool changed = sf.run();
+    errs() << F.getName() << ": forwarded " << sf.NumLoads << " loads, removed "
+           << sf.NumStores << " stores and " << sf.NumAllocas << " allocas\n";
+    return changed;
+  }
+};
+
+char LegacyStoreForwardingPass::ID = 0;
+static RegisterPass<LegacyStoreForwardingPass> Z(
+    "cse231-store-forward",
+    "Store-to-load Forwarding",
+    true, // This pass doesn't modify the CFG => true
+    false // This pass is not a pure analysis pass => false
+);
@@ -0,0 +1,220 @@
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/InstVisitor.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "../DFA/231DFA.h"
+#include "../DFA/231Driver.h"
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+using namespace llvm;
+
+cl::opt<unsigned> Threads("cse231-steensgaard-threads",
+    cl::desc("Number of threads analyzing functions (0: one per hardware thread)"),
+    cl::init(1));
+
+// no node
+const unsigned None = ~0u;
+
+/*
+ * Unification-based (Steensgaard) may-point-to of a function with the rules of
+ * MayPointToAnalysis. The register R of every instruction and the memory M of
+ * every alloca are nodes of a union-find, and each class points to at most one
+ * class: x = y merges the targets of x and y instead of including one in the
+ * other. The facts hold for the whole function and take almost linear time,
+ * so print() gives every edge of the DFA framework the same line.
+ */
+struct SteensgaardAnalysis: InstVisitor<SteensgaardAnalysis> {
+  // Node i is the register of the instruction with index i, as in the DFA framework
+  explicit SteensgaardAnalysis(Function &F): F(F) {
+    unsigned counter = 1;
+    for (auto &I: instructions(F)) {
+      InstrToIndex[&I] = counter++;
+    }
+    for (unsigned i = 0; i < counter; ++i) {
+      newNode();
+    }
+    Memory.assign(counter, None);
+    visit(F);
+  }
+
+  void visitAllocaInst(AllocaInst &I) {
+    auto idx = InstrToIndex.lookup(&I);
+    Memory[idx] = newNode();
+    join(pointee(idx), Memory[idx]);
+  }
+  void visitBitCastInst(BitCastInst &I) {
+    if (auto *instr = dyn_cast<Instruction>(I.getOperand(0))) {
+      assign(&I, instr);
+    }
+  }
+  void visitGetElementPtrInst(GetElementPtrInst &I) {
+    if (auto *instr = dyn_cast<Instruction>(I.getPointerOperand())) {
+      assign(&I, instr);
+    }
+  }
+  void visitLoadInst(LoadInst &I) {
+    if (auto *rp = dyn_cast<Instruction>(I.getPointerOperand())) {
+      join(pointee(InstrToIndex.lookup(&I)), pointee(pointee(InstrToIndex.lookup(rp))));
+    }
+  }
+  void visitStoreInst(StoreInst &I) {
+    auto *rv = dyn_cast<Instruction>(I.getValueOperand());
+    auto *rp = dyn_cast<Instruction>(I.getPointerOperand());
+    if (rv && rp) {
+      join(pointee(pointee(InstrToIndex.lookup(rp))), pointee(InstrToIndex.lookup(rv)));
+    }
+  }
+  void visitSelectInst(SelectInst &I) {
+    for (auto *op: {I.getTrueValue(), I.getFalseValue()}) {
+      if (auto *ri = dyn_cast<Instruction>(op)) {
+        assign(&I, ri);
+      }
+    }
+  }
+  void visitPHINode(PHINode &I) {
+    for (auto &op: I.incoming_values()) {
+      if (auto *ri = dyn_cast<Instruction>(op.get())) {
+        assign(&I, ri);
+      }
+    }
+  }
+  void visitInstruction(Instruction &I) {}
+
+  /*
+   * The facts on each edge of the forward DFA framework, in its order, so
+   * that the output is diffed line by line against cse231-maypointto
+   */
+  void print(raw_ostream &OS) {
+    std::string facts;
+    raw_string_ostream factsOS(facts);
+    printFacts(factsOS);
+    factsOS.flush();
+
+    std::set<std::pair<unsigned, unsigned>> edges;
+    forEachForwardEdge(F, [&](Instruction *src, Instruction *dst) {
+      edges.insert({InstrToIndex.lookup(src), InstrToIndex.lookup(dst)});
+    });
+    for (auto &edge: edges) {
+      OS << "Edge " << edge.first << "->" "Edge " << edge.second << ":" << facts;
+    }
+  }
+
+  // One line in the format of MayPointToInfo::print
+  void printFacts(raw_ostream &OS) {
+    // the allocas in each class, in index order
+    DenseMap<unsigned, std::vector<unsigned>> allocas;
+    for (unsigned idx = 0; idx < Memory.size(); ++idx) {
+      if (Memory[idx] != None)
+        allocas[find(Memory[idx])].push_back(idx);
+    }
+
+    auto printTargets = [&](char kind, unsigned idx, unsigned n) {
+      unsigned p = Pointee[find(n)];
+      if (p == None)
+        return;
+      auto it = allocas.find(find(p));
+      if (it == allocas.end())
+        return;
+      OS << kind << idx << "->(";
+      for (auto m: it->second) {
+        OS << "M" << m << "/";
+      }
+      OS << ")|";
+    };
+    for (unsigned idx = 0; idx < Memory.size(); ++idx) {
+      if (Memory[idx] != None)
+        printTargets('M', idx, Memory[idx]);
+    }
+    for (unsigned idx = 1; idx < Memory.size(); ++idx) {
+      printTargets('R', idx, idx);
+    }
+    OS << "\n";
+  }
+
+private:
+  unsigned newNode() {
+    Parent.push_back(Parent.size());
+    Rank.push_back(0);
+    Pointee.push_back(None);
+    return Parent.size() - 1;
+  }
+
+  unsigned find(unsigned n) {
+    while (Parent[n] != n)
+      n = Parent[n] = Parent[Parent[n]];
+    return n;
+  }
+
+  // The class n points to, created empty if there is none yet
+  unsigned pointee(unsigned n) {
+    n = find(n);
+    if (Pointee[n] == None) {
+      unsigned p = newNode();
+      Pointee[n] = p;
+    }
+    return Pointee[n];
+  }
+
+  // x = y: the targets of x and y become one class
+  void assign(Instruction *x, Instruction *y) {
+    join(pointee(InstrToIndex.lookup(x)), pointee(InstrToIndex.lookup(y)));
+  }
+
+  // Merge two classes, and then the classes they point to
+  void join(unsigned a, unsigned b) {
+    std::vector<std::pair<unsigned, unsigned>> pending{{a, b}};
+    while (!pending.empty()) {
+      a = find(pending.back().first);
+      b = find(pending.back().second);
+      pending.pop_back();
+      if (a == b)
+        continue;
+      if (Rank[a] < Rank[b])
+        std::swap(a, b);
+      Parent[b] = a;
+      if (Rank[a] == Rank[b])
+        Rank[a]++;
+      if (Pointee[a] == None)
+        Pointee[a] = Pointee[b];
+      else if (Pointee[b] != None)
+        pending.push_back({Pointee[a], Pointee[b]});
+    }
+  }
+
+  Function &F;
+  DenseMap<Instruction*, unsigned> InstrToIndex;
+  std::vector<unsigned> Parent;
+  std::vector<unsigned> Rank;
+  std::vector<unsigned> Pointee;
+  // the memory node of the alloca with each index, or None
+  std::vector<unsigned> Memory;
+};
+
+} // namespace
+
+struct LegacySteensgaardPass: public ModulePass {
+  static char ID;
+  LegacySteensgaardPass(): ModulePass(ID) {}
+
+  // the facts of every edge of each function, all the same
+  bool runOnModule(Module &M) override {
+    runOnFunctions(M, Threads, [](Function &F, raw_ostream &OS) {
+      SteensgaardAnalysis(F).print(OS);
+    });
+    // Doesn't modify the input unit of IR, hence 'false'
+    return false;
+  }
+};
+
+char LegacySteensgaardPass::ID = 0;
+static RegisterPass<LegacySteensgaardPass> X(
+    "cse231-steensgaard",
+    "Steensgaard May-point-to Analysis",
+    true, // This pass doesn't modify the CFG => true
+    false // This pass is not a pure analysis pass => false
+);
@@ -1,14 +1,28 @@
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/PointerIntPair.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/CallGraphSCCPass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/PassSupport.h"
 #include "llvm/IR/ConstantFolder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Transforms/Utils/Local.h"
 
+#include "../DFA/231Andersen.h"
 #include "../DFA/231DFA.h"
+#include "../DFA/231Driver.h"
+#include "../DFA/231ModRef.h"
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
 #include <set>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 /*
  * Note: This implementation is quite different from the one demonstrated 
  * in the CSE231 lectures (MUST analysis, downward towards the Bottom).
@@ -20,10 +34,26 @@
  */
 using namespace llvm;
 using Values = std::set<Value*>;
-using GlobalVars = std::set<GlobalVariable*>;
-using FuncMap = std::unordered_map<Function*, std::set<GlobalVariable*>>;
 
 namespace {
+  enum class ConstPropEngine { Dense, SCCP };
+  cl::opt<ConstPropEngine> Engine("cse231-constprop-engine",
+      cl::desc("Choose the constant propagation solver"),
+      cl::values(
+        clEnumValN(ConstPropEngine::Dense, "dense", "one ConstPropInfo per edge (default)"),
+        clEnumValN(ConstPropEngine::SCCP, "sccp", "sparse conditional, cells per SSA value and global")),
+      cl::init(ConstPropEngine::Dense));
+
+  cl::opt<unsigned> Threads("cse231-constprop-threads",
+      cl::desc("Number of threads analyzing functions (0: one per hardware thread)"),
+      cl::init(1));
+
+  cl::opt<bool> AndersenMPT("cse231-constprop-andersen",
+      cl::desc("Compute MPT with the Andersen points-to analysis"));
+
+  // Folded constants are uniqued in the LLVMContext, which is not thread-safe
+  std::mutex FoldMutex;
+
   /*
    * Lattice:
    *          Top: AllConst (Undefined)
@@ -33,123 +63,195 @@ namespace {
    *         Bottom: NAC
    */
   enum class ConstState { AllConst, Const, NotConst };
+
+  /*
+   * One lattice cell in a pointer-sized word: the state in spare low bits of
+   * the constant pointer. AllConst is 0 and NotConst carries no constant, so
+   * two cells are equal iff their words are, and the meet is a few compares.
+   */
   struct Const {
-    ConstState state;
-    Constant* value;
+    Const(): cell(nullptr, ConstState::AllConst) {}
+    Const(ConstState state, Constant* value): cell(value, state) {}
+
+    ConstState state() const { return cell.getInt(); }
+    Constant* value() const { return cell.getPointer(); }
+
     bool operator==(const Const& rhs) const {
-      return state == rhs.state && value == rhs.value;
+      return cell == rhs.cell;
+    }
+    bool operator!=(const Const& rhs) const {
+      return cell != rhs.cell;
     }
 
     static Const meet(const Const& c1, const Const& c2) {
-      //      / All    => NAC
-      // NAC -- Const  => NAC
-      //      \ NAC    => NAC
-      if (c1.state == ConstState::NotConst || c2.state == ConstState::NotConst) {
-        return {ConstState::NotConst, nullptr};
-      }
-      //      / All    => All
-      // All 
-      //      \ Const  => Const
-      else if (c1.state == ConstState::AllConst && c2.state == ConstState::AllConst) {
-        return {ConstState::AllConst, nullptr};
-      } else if (c1.state == ConstState::AllConst && c2.state == ConstState::Const) {
-        return {ConstState::Const, c2.value};
-      } else if (c2.state == ConstState::AllConst && c1.state == ConstState::Const) {
-        return {ConstState::Const, c1.value};
-      }
       //                      / c0 == c1  => Const
-      // Const c0 - Const c1 
+      // Const c0 - Const c1
       //                      \ c0 != c1  => NAC
-      else if (c1.state == ConstState::Const && c2.state == ConstState::Const) {
-        if (c1.value == c2.value) {
-          return {ConstState::Const, c1.value};
-        } else {
-          return {ConstState::NotConst, nullptr};
-        }
+      // All  - x  => x
+      // NAC  - x  => NAC
+      auto a = reinterpret_cast<uintptr_t>(c1.cell.getOpaqueValue());
+      auto b = reinterpret_cast<uintptr_t>(c2.cell.getOpaqueValue());
+      auto nac = reinterpret_cast<uintptr_t>(Const(ConstState::NotConst, nullptr).cell.getOpaqueValue());
+      uintptr_t m = a == b ? a : a == 0 ? b : b == 0 ? a : nac;
+      Const c;
+      c.cell = decltype(cell)::getFromOpaqueValue(reinterpret_cast<void*>(m));
+      return c;
+    }
+  private:
+    PointerIntPair<Constant*, 2, ConstState> cell;
+  };
+
+  // Dense slot of every global variable, built once per module and shared read-only
+  struct GlobalSlots {
+    explicit GlobalSlots(Module &M) {
+      for (auto &gv: M.globals()) {
+        Slot[&gv] = Globals.size();
+        Globals.push_back(&gv);
       }
     }
+    DenseMap<const Value*, unsigned> Slot;
+    std::vector<GlobalVariable*> Globals;
   };
 
-  using ConstPropContent = std::unordered_map<Value*, struct Const>;
+  /*
+   * The globals are an array of cells indexed by slot, all AllConst at first.
+   * Any other value (a register, an alloca in MPT) lives in a side table sorted
+   * by address, where a missing value is AllConst.
+   */
   struct ConstPropInfo: Info {
     ConstPropInfo() {}
-    ConstPropInfo(const ConstPropInfo& other): Info(other) {
-      data = other.data;
-    }
+    explicit ConstPropInfo(const GlobalSlots* slots)
+      : slots(slots), globals(slots->Globals.size()) {}
+    ConstPropInfo(const ConstPropInfo& other) = default;
+    ConstPropInfo& operator=(const ConstPropInfo& other) = default;
     ~ConstPropInfo() override {}
 
-    void print() override {
-      for (auto &p: data) {
-        if (nullptr == dyn_cast<GlobalVariable>(p.first)) {
-          continue;
-        }
-        errs() << (p.first)->getName() << "=";
+    void print(raw_ostream &OS) override {
+      if (slots) {
+        printGlobals(OS, *slots, globals.data());
+      } else {
+        OS << "\n";
+      }
+    }
+
+    // One line with the cells of all globals, cells[i] for the global in slot i
+    static void printGlobals(raw_ostream &OS, const GlobalSlots &slots, const Const* cells) {
+      for (unsigned i = 0; i < slots.Globals.size(); ++i) {
+        OS << slots.Globals[i]->getName() << "=";
         // accordant to the definition of Lattice in the lecture
-        switch (p.second.state) {
+        switch (cells[i].state()) {
           case ConstState::NotConst: {
-            errs() << "⊤|";
+            OS << "⊤|";
             break;
           }
           case ConstState::Const: {
-            errs() << *p.second.value << "|";
+            OS << *cells[i].value() << "|";
             break;
           }
           case ConstState::AllConst: {
-            errs() << "⊥|";
+            OS << "⊥|";
             break;
           }
         }
       }
-      errs() << "\n";
+      OS << "\n";
+    }
+
+    const GlobalSlots* getSlots() const {
+      return slots;
     }
 
     void setTop(Value* v) {
-      data[v] = {ConstState::AllConst, nullptr};
+      cell(v) = {ConstState::AllConst, nullptr};
     }
 
     void setBottom(Value* v) {
-      data[v] = {ConstState::NotConst, nullptr};
+      cell(v) = {ConstState::NotConst, nullptr};
     }
 
     void setConst(Value* v, Constant* c) {
-      data[v] = {ConstState::Const, c};
+      cell(v) = {ConstState::Const, c};
     }
 
-    Const& operator[] (Value *v) {
-      return data.at(v);
-    }
-
-    Constant* getConstant(Value *v) {
-      auto it = data.find(v);
-      if (it == data.end()) {
-        return nullptr;
-      } else {
-        return it->second.value;
+    Constant* getConstant(Value *v) const {
+      if (slots) {
+        auto it = slots->Slot.find(v);
+        if (it != slots->Slot.end())
+          return globals[it->second].value();
       }
+      auto it = findLocal(v);
+      if (it == locals.end() || it->first != v)
+        return nullptr;
+      return it->second.value();
     }
 
     static bool equals(ConstPropInfo* lhs, ConstPropInfo* rhs) {
-      return lhs->data == rhs->data;
+      return lhs->globals == rhs->globals && lhs->locals == rhs->locals;
     }
 
     ConstPropInfo& join(ConstPropInfo& rhs) {
-      for (auto &p: rhs.data) {
-        auto &key = p.first;
-        if (data.find(key) == data.end()) {
-          data[key] = rhs.data[key];
+      // a default-constructed info takes the slots of the first one joined in
+      if (!slots) {
+        slots = rhs.slots;
+        globals = rhs.globals;
+      } else {
+        for (unsigned i = 0; i < globals.size(); ++i) {
+          globals[i] = Const::meet(globals[i], rhs.globals[i]);
+        }
+      }
+
+      if (rhs.locals.empty()) {
+        return *this;
+      }
+      if (locals.empty()) {
+        locals = rhs.locals;
+        return *this;
+      }
+      Locals merged;
+      merged.reserve(locals.size() + rhs.locals.size());
+      auto l = locals.begin(), le = locals.end();
+      auto r = rhs.locals.begin(), re = rhs.locals.end();
+      while (l != le || r != re) {
+        if (r == re || (l != le && l->first < r->first)) {
+          merged.push_back(*l++);
+        } else if (l == le || r->first < l->first) {
+          merged.push_back(*r++);
         } else {
-          data[key] = Const::meet(data[key], rhs.data[key]);
+          merged.push_back({l->first, Const::meet(l->second, r->second)});
+          ++l, ++r;
         }
       }
+      locals = std::move(merged);
       return *this;
     }
   private:
-    ConstPropContent data;
+    using Locals = std::vector<std::pair<Value*, Const>>;
+
+    Locals::const_iterator findLocal(Value* v) const {
+      return std::lower_bound(locals.begin(), locals.end(), v,
+          [](const std::pair<Value*, Const>& p, Value* v) { return p.first < v; });
+    }
+
+    Const& cell(Value* v) {
+      if (slots) {
+        auto it = slots->Slot.find(v);
+        if (it != slots->Slot.end())
+          return globals[it->second];
+      }
+      auto it = locals.begin() + (findLocal(v) - locals.begin());
+      if (it == locals.end() || it->first != v)
+        it = locals.insert(it, {v, Const()});
+      return it->second;
+    }
+
+    const GlobalSlots* slots = nullptr;
+    std::vector<Const> globals;
+    Locals locals;
   };
 
   struct ConstPropAnalysis: DataFlowAnalysis<ConstPropInfo, true> {
-    ConstPropAnalysis(ConstPropInfo& bottom, ConstPropInfo& initState, FuncMap& fm, Values& mpt)
-      : DataFlowAnalysis(bottom, initState), mods(fm), mpt(mpt) {
+    ConstPropAnalysis(ConstPropInfo& bottom, ConstPropInfo& initState, const GlobalModRefInfo& modref, const Values& mpt)
+      : DataFlowAnalysis(bottom, initState), modref(modref), mpt(mpt) {
       folder = new ConstantFolder{};
     }
 
@@ -157,9 +259,120 @@ namespace {
       delete folder;
     }
 
+    /*
+     * The SCCP engine answers the same question as runWorklistAlgorithm from
+     * one lattice cell per instruction and, per basic block, the cells of the
+     * tracked memory on entry: the globals, the allocas of F, then the other
+     * pointers F loads or stores through, with the memory model of
+     * flowfunction, which keys memory by the pointer Value. Blocks are only
+     * visited once an edge into them is known to be executable, and a
+     * conditional branch on a constant makes only one of its edges
+     * executable, so infeasible paths do not reach the Phi nodes. A cell that
+     * changes queues its users on the SSA worklist; pure users are
+     * re-evaluated alone, the others revisit their block.
+     */
+    void runSCCPAlgorithm(Function* F) {
+      initializeForwardMap(F);
+      computeNodeRanks();
+      prepareSCCP(F);
+      NumIterations = 0;
+      NumVisits = 0;
+      Mode = ConstPropEngine::SCCP;
+
+      std::vector<unsigned> blockRank(Blocks.size());
+      for (unsigned b = 0; b < Blocks.size(); ++b) {
+        blockRank[b] = NodeRank[InstrToIndex.lookup(&Blocks[b]->front())];
+      }
+      BlockWorklist.reset(blockRank);
+      SSAWorklist.reset(NodeRank);
+
+      // the entry block starts from InitialState, every tracked alloca unknown
+      BlockIn[0].assign(NumSlots, Const(ConstState::NotConst, nullptr));
+      for (unsigned i = 0; i < Slots->Globals.size(); ++i) {
+        if (auto c = InitialState.getConstant(Slots->Globals[i])) {
+          BlockIn[0][i] = Const(ConstState::Const, c);
+        }
+      }
+      Executable.set(0);
+      BlockWorklist.push(0);
+
+      while (!SSAWorklist.empty() || !BlockWorklist.empty()) {
+        while (!SSAWorklist.empty()) {
+          auto I = IndexToInstr[SSAWorklist.pop()];
+          NumIterations++;
+          if (I->isTerminator() || I->mayReadOrWriteMemory() || isa<CallBase>(I)) {
+            BlockWorklist.push(BlockIndex.lookup(I->getParent()));
+          } else {
+            NumVisits++;
+            updateCell(I, evaluate(I, nullptr));
+          }
+        }
+        if (!BlockWorklist.empty()) {
+          NumIterations++;
+          visitBlock(BlockWorklist.pop());
+        }
+      }
+    }
+
+    /*
+     * Whether the SCCP engine tracks stores to memory that pointers may reach.
+     * Its memory model, that of flowfunction, does not see writes through
+     * them; a transform turns this off to only track memory that is never
+     * pointed to, such as an internal global that is only loaded and stored.
+     * Call it before runSCCPAlgorithm.
+     */
+    void setTrackAliasedMemory(bool on) {
+      TrackAliased = on;
+    }
+
+    // After runSCCPAlgorithm: the constant V always is, or nullptr
+    Constant* getSCCPConstant(Value* V) const {
+      if (auto *c = dyn_cast<Constant>(V)) {
+        return c;
+      }
+      auto *I = dyn_cast<Instruction>(V);
+      if (!I || Cells[InstrToIndex.lookup(I)].state() != ConstState::Const) {
+        return nullptr;
+      }
+      return Cells[InstrToIndex.lookup(I)].value();
+    }
+
+    // After runSCCPAlgorithm: whether an executable edge leads to BB
+    bool isExecutable(BasicBlock* BB) const {
+      return Executable.test(BlockIndex.lookup(BB));
+    }
+
+    using DataFlowAnalysis::print;
+    void print(raw_ostream &OS) override {
+      if (Mode == ConstPropEngine::Dense) {
+        DataFlowAnalysis::print(OS);
+        return;
+      }
+
+      // the memory after each node is recomputed from the block entries in
+      // index order, which is also the order of EdgeToInfo
+      std::vector<Const> unreached(NumSlots);
+      OS << "Edge 0->Edge " << InstrToIndex.lookup(EntryInstr) << ":";
+      InitialState.print(OS);
+      for (unsigned b = 0; b < Blocks.size(); ++b) {
+        std::vector<Const> state = Executable.test(b) ? BlockIn[b] : unreached;
+        for (auto &I: *Blocks[b]) {
+          applyMemory(&I, state);
+          unsigned src = InstrToIndex.lookup(&I);
+          for (unsigned k = SuccBegin[src]; k != SuccBegin[src + 1]; ++k) {
+            auto dst = IndexToInstr[Succs[k]];
+            bool feasible = Executable.test(b) &&
+                (!I.isTerminator() || Feasible.count({Blocks[b], dst->getParent()}));
+            OS << "Edge " << src << "->" "Edge " << Succs[k] << ":";
+            ConstPropInfo::printGlobals(OS, *Slots, feasible ? state.data() : unreached.data());
+          }
+        }
+      }
+    }
+
     void flowfunction(Instruction* I, std::vector<unsigned>& IncomingEdges,
                       std::vector<unsigned>& OutgoingEdges, std::vector<ConstPropInfo*>& Infos) override {
-      unsigned cur = InstrToIndex.at(I);
+      unsigned cur = InstrToIndex.lookup(I);
       ConstPropInfo in{};
       for (auto e: IncomingEdges) {
         in = in.join(*EdgeToInfo.at({e, cur}));
@@ -180,6 +393,7 @@ namespace {
         auto lhs = tryConst(bop->getOperand(0));
         auto rhs = tryConst(bop->getOperand(1));
         if (lhs && rhs) {
+          std::lock_guard<std::mutex> lock(FoldMutex);
           in.setConst(I, folder->CreateBinOp(bop->getOpcode(), lhs, rhs));
         } else {
           in.setBottom(I);
@@ -187,6 +401,7 @@ namespace {
       } else if (auto *uop = dyn_cast<UnaryOperator>(I)) {
         auto c = tryConst(uop->getOperand(0));
         if (c) {
+          std::lock_guard<std::mutex> lock(FoldMutex);
           in.setConst(I, folder->CreateUnOp(uop->getOpcode(), c));
         } else {
           in.setBottom(I);
@@ -215,20 +430,17 @@ namespace {
             in.setBottom(v);
           }
         }
-      } else if (auto *call = dyn_cast<CallInst>(I)) {
-        auto callee = call->getCalledFunction();
-        if (callee) {
-          // for v in MOD[callee]: set v to NAC
-          auto &mod = mods[callee];
-          for (auto &gv: mod) {
-            in.setBottom(gv);
-          }
+      } else if (auto *call = dyn_cast<CallBase>(I)) {
+        // for v in MOD[callee]: set v to NAC
+        for (unsigned id: modref.getMod(*call).set_bits()) {
+          in.setBottom(modref.getGlobal(id));
         }
       } else if (auto *icmp = dyn_cast<ICmpInst>(I)) {
         auto pred = icmp->getPredicate();
         auto lhs = tryConst(icmp->getOperand(0));
         auto rhs = tryConst(icmp->getOperand(1));
         if (lhs && rhs) {
+          std::lock_guard<std::mutex> lock(FoldMutex);
           in.setConst(I, folder->CreateICmp(pred, lhs, rhs));
         } else {
           in.setBottom(I);
@@ -238,6 +450,7 @@ namespace {
         auto lhs = tryConst(fcmp->getOperand(0));
         auto rhs = tryConst(fcmp->getOperand(1));
         if (lhs && rhs) {
+          std::lock_guard<std::mutex> lock(FoldMutex);
           in.setConst(I, folder->CreateFCmp(pred, lhs, rhs));
         } else {
           in.setBottom(I);
@@ -271,25 +484,308 @@ namespace {
         in.setBottom(I);
       }
 
-      for (size_t i = 0; i < OutgoingEdges.size(); ++i) {
-        Infos.push_back(new ConstPropInfo(in));
-      }
+      // all outgoing edges share one copy of in
+      Infos.assign(OutgoingEdges.size(), newInfo(in));
     }
   private:
     ConstantFolder* folder;
-    FuncMap&        mods;
-    Values&         mpt;
-  };
-}
+    const GlobalModRefInfo& modref;
+    const Values&   mpt;
 
-struct LegacyConstPropPass: CallGraphSCCPass {
-  static char ID;
-  LegacyConstPropPass(): CallGraphSCCPass(ID) {}
+    // Number the blocks and the tracked memory of F for the SCCP engine
+    void prepareSCCP(Function* F) {
+      Slots = Bottom.getSlots();
+      NumSlots = Slots->Globals.size();
+      for (auto &BB: *F) {
+        BlockIndex[&BB] = Blocks.size();
+        Blocks.push_back(&BB);
+      }
+      for (auto &I: instructions(F)) {
+        if (isa<AllocaInst>(I)) {
+          AllocaSlot[&I] = NumSlots++;
+        }
+      }
+      unsigned firstPointer = NumSlots;
+      for (auto &I: instructions(F)) {
+        Value* ptr = nullptr;
+        if (auto *load = dyn_cast<LoadInst>(&I)) {
+          ptr = load->getPointerOperand();
+        } else if (auto *store = dyn_cast<StoreInst>(&I)) {
+          ptr = store->getPointerOperand();
+        }
+        if (ptr && !Slots->Slot.count(ptr) && !AllocaSlot.count(ptr) && !PointerSlot.count(ptr)) {
+          PointerSlot[ptr] = NumSlots++;
+        }
+      }
+      Untracked.resize(NumSlots);
+      if (!TrackAliased) {
+        // what a pointer reaches is unknown
+        Untracked.set(firstPointer, NumSlots);
+        for (unsigned i = 0; i < Slots->Globals.size(); ++i) {
+          if (!isOnlyLoadedAndStored(Slots->Globals[i])) {
+            Untracked.set(i);
+          }
+        }
+        for (auto &a: AllocaSlot) {
+          if (!isOnlyLoadedAndStored(a.first)) {
+            Untracked.set(a.second);
+          }
+        }
+      }
+      for (auto v: mpt) {
+        int slot = slotOf(v);
+        if (slot >= 0) {
+          MPTSlots.push_back(slot);
+        }
+      }
+      BlockIn.assign(Blocks.size(), std::vector<Const>(NumSlots));
+      Executable.resize(Blocks.size());
+      Cells.assign(IndexToInstr.size(), Const());
+    }
 
-  // calculate MPT and LMOD here
-  bool doInitialization(CallGraph &CG) override {
+    // The memory slot v is tracked in, or -1
+    int slotOf(Value* v) const {
+      int slot = -1;
+      auto g = Slots->Slot.find(v);
+      if (g != Slots->Slot.end()) {
+        slot = g->second;
+      } else {
+        auto a = AllocaSlot.find(v);
+        if (a != AllocaSlot.end()) {
+          slot = a->second;
+        }
+        auto p = PointerSlot.find(v);
+        if (p != PointerSlot.end()) {
+          slot = p->second;
+        }
+      }
+      return slot >= 0 && Untracked.test(slot) ? -1 : slot;
+    }
+
+    Const valueOf(Value* v) const {
+      if (auto *I = dyn_cast<Instruction>(v)) {
+        return Cells[InstrToIndex.lookup(I)];
+      } else if (auto *c = dyn_cast<Constant>(v)) {
+        return Const(ConstState::Const, c);
+      }
+      return Const(ConstState::NotConst, nullptr);
+    }
+
+    // Fold op over the operand cells: NAC if one is NAC, undefined while one is
+    static Const foldOperands(std::initializer_list<Const> ops, function_ref<Constant*()> op) {
+      for (auto &c: ops) {
+        if (c.state() == ConstState::NotConst) {
+          return c;
+        }
+      }
+      for (auto &c: ops) {
+        if (c.state() == ConstState::AllConst) {
+          return c;
+        }
+      }
+      std::lock_guard<std::mutex> lock(FoldMutex);
+      return Const(ConstState::Const, op());
+    }
+
+    /*
+     * The cell of the value of I. Loads read the memory in state, which is
+     * only null for the instructions without memory access.
+     */
+    Const evaluate(Instruction* I, const std::vector<Const>* state) {
+      if (auto *bop = dyn_cast<BinaryOperator>(I)) {
+        auto lhs = valueOf(bop->getOperand(0)), rhs = valueOf(bop->getOperand(1));
+        return foldOperands({lhs, rhs}, [&] {
+          return folder->CreateBinOp(bop->getOpcode(), lhs.value(), rhs.value());
+        });
+      } else if (auto *uop = dyn_cast<UnaryOperator>(I)) {
+        auto c = valueOf(uop->getOperand(0));
+        return foldOperands({c}, [&] {
+          return folder->CreateUnOp(uop->getOpcode(), c.value());
+        });
+      } else if (auto *cast = dyn_cast<CastInst>(I)) {
+        auto c = valueOf(cast->getOperand(0));
+        return foldOperands({c}, [&] {
+          return folder->CreateCast(cast->getOpcode(), c.value(), cast->getDestTy());
+        });
+      } else if (auto *icmp = dyn_cast<ICmpInst>(I)) {
+        auto lhs = valueOf(icmp->getOperand(0)), rhs = valueOf(icmp->getOperand(1));
+        return foldOperands({lhs, rhs}, [&] {
+          return folder->CreateICmp(icmp->getPredicate(), lhs.value(), rhs.value());
+        });
+      } else if (auto *fcmp = dyn_cast<FCmpInst>(I)) {
+        auto lhs = valueOf(fcmp->getOperand(0)), rhs = valueOf(fcmp->getOperand(1));
+        return foldOperands({lhs, rhs}, [&] {
+          return folder->CreateFCmp(fcmp->getPredicate(), lhs.value(), rhs.value());
+        });
+      } else if (auto *phi = dyn_cast<PHINode>(I)) {
+        // only the values flowing in over executable edges
+        Const c;
+        for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+          if (Feasible.count({phi->getIncomingBlock(i), phi->getParent()})) {
+            c = Const::meet(c, valueOf(phi->getIncomingValue(i)));
+          }
+        }
+        return c;
+      } else if (auto *select = dyn_cast<SelectInst>(I)) {
+        auto cond = valueOf(select->getCondition());
+        if (cond.state() == ConstState::AllConst) {
+          return cond;
+        }
+        if (auto *ci = dyn_cast_or_null<ConstantInt>(cond.value())) {
+          return valueOf(ci->isZero() ? select->getFalseValue() : select->getTrueValue());
+        }
+        return Const::meet(valueOf(select->getTrueValue()), valueOf(select->getFalseValue()));
+      } else if (auto *load = dyn_cast<LoadInst>(I)) {
+        int slot = slotOf(load->getPointerOperand());
+        if (slot >= 0 && state) {
+          return (*state)[slot];
+        }
+      }
+      return Const(ConstState::NotConst, nullptr);
+    }
+
+    // The effect of I on the tracked memory, the same as in flowfunction
+    void applyMemory(Instruction* I, std::vector<Const>& state) {
+      if (auto *store = dyn_cast<StoreInst>(I)) {
+        auto ptr = store->getPointerOperand();
+        int slot = slotOf(ptr);
+        if (slot >= 0) {
+          state[slot] = valueOf(store->getValueOperand());
+        }
+        if (isa<LoadInst>(ptr)) {
+          for (auto s: MPTSlots) {
+            state[s] = Const(ConstState::NotConst, nullptr);
+          }
+        }
+      } else if (auto *call = dyn_cast<CallBase>(I)) {
+        for (unsigned id: modref.getMod(*call).set_bits()) {
+          state[Slots->Slot.lookup(modref.getGlobal(id))] = Const(ConstState::NotConst, nullptr);
+        }
+      } else if (AllocaSlot.count(I)) {
+        // fresh memory on every execution
+        state[AllocaSlot.lookup(I)] = Const(ConstState::NotConst, nullptr);
+      }
+      // flowfunction writes the value of a pointer to the cell of its memory
+      auto p = PointerSlot.find(I);
+      if (p != PointerSlot.end() && !Untracked.test(p->second)) {
+        state[p->second] = Cells[InstrToIndex.lookup(I)];
+      }
+    }
+
+    // Lower the cell of I, queueing its users in executable blocks if it changed
+    void updateCell(Instruction* I, Const c) {
+      auto &cell = Cells[InstrToIndex.lookup(I)];
+      c = Const::meet(cell, c);
+      if (c == cell) {
+        return;
+      }
+      cell = c;
+      // the memory its pointer keys changes too
+      if (PointerSlot.count(I) && I->getParent() != Visiting) {
+        BlockWorklist.push(BlockIndex.lookup(I->getParent()));
+      }
+      unsigned idx = InstrToIndex.lookup(I);
+      for (auto *U: I->users()) {
+        auto *user = dyn_cast<Instruction>(U);
+        if (!user || !Executable.test(BlockIndex.lookup(user->getParent()))) {
+          continue;
+        }
+        // the block being visited reaches the later users by itself
+        unsigned userIdx = InstrToIndex.lookup(user);
+        if (user->getParent() == Visiting && userIdx > idx) {
+          continue;
+        }
+        SSAWorklist.push(userIdx);
+      }
+    }
+
+    // Evaluate block b from its entry memory and propagate to the feasible successors
+    void visitBlock(unsigned b) {
+      auto BB = Blocks[b];
+      std::vector<Const> state = BlockIn[b];
+      Visiting = BB;
+      for (auto &I: *BB) {
+        NumVisits++;
+        if (!I.getType()->isVoidTy()) {
+          updateCell(&I, evaluate(&I, &state));
+        }
+        applyMemory(&I, state);
+      }
+      Visiting = nullptr;
+
+      auto term = BB->getTerminator();
+      SmallVector<BasicBlock*, 2> succs;
+      Const cond;
+      if (auto *br = dyn_cast<BranchInst>(term)) {
+        if (br->isConditional()) {
+          cond = valueOf(br->getCondition());
+        }
+      } else if (auto *sw = dyn_cast<SwitchInst>(term)) {
+        cond = valueOf(sw->getCondition());
+      }
+      auto *ci = dyn_cast_or_null<ConstantInt>(cond.value());
+      if (auto *br = dyn_cast<BranchInst>(term)) {
+        if (br->isUnconditional() || cond.state() == ConstState::NotConst || (cond.value() && !ci)) {
+          succs.append(succ_begin(BB), succ_end(BB));
+        } else if (ci) {
+          succs.push_back(br->getSuccessor(ci->isZero() ? 1 : 0));
+        }
+      } else if (auto *sw = dyn_cast<SwitchInst>(term)) {
+        if (ci) {
+          succs.push_back(sw->findCaseValue(ci)->getCaseSuccessor());
+        } else if (cond.state() != ConstState::AllConst) {
+          succs.append(succ_begin(BB), succ_end(BB));
+        }
+      } else {
+        succs.append(succ_begin(BB), succ_end(BB));
+      }
+
+      for (auto succ: succs) {
+        unsigned s = BlockIndex.lookup(succ);
+        bool changed = Feasible.insert({BB, succ}).second;
+        if (!Executable.test(s)) {
+          Executable.set(s);
+          BlockIn[s] = state;
+          changed = true;
+        } else {
+          for (unsigned i = 0; i < NumSlots; ++i) {
+            auto c = Const::meet(BlockIn[s][i], state[i]);
+            changed |= c != BlockIn[s][i];
+            BlockIn[s][i] = c;
+          }
+        }
+        if (changed) {
+          BlockWorklist.push(s);
+        }
+      }
+    }
+
+    // SCCP engine state, see runSCCPAlgorithm
+    ConstPropEngine Mode = ConstPropEngine::Dense;
+    const GlobalSlots* Slots = nullptr;
+    unsigned NumSlots = 0;
+    DenseMap<Value*, unsigned> AllocaSlot;
+    // the other pointers loaded or stored through
+    DenseMap<Value*, unsigned> PointerSlot;
+    bool TrackAliased = true;
+    // slots that stores do not update, see setTrackAliasedMemory
+    BitVector Untracked;
+    std::vector<unsigned> MPTSlots;
+    std::vector<BasicBlock*> Blocks;
+    DenseMap<BasicBlock*, unsigned> BlockIndex;
+    // the memory on entry to each executable block
+    std::vector<std::vector<Const>> BlockIn;
+    BitVector Executable;
+    DenseSet<std::pair<BasicBlock*, BasicBlock*>> Feasible;
+    std::vector<Const> Cells;
+    OrderedWorklist BlockWorklist, SSAWorklist;
+    BasicBlock* Visiting = nullptr;
+  };
+
+  // MPT from the syntax: every value whose address may be taken
+  Values computeMPT(Module &M) {
+    Values mpt;
     // MPT case 1: global1 = &global2 => MPT -> {global2}
-    auto &M = CG.getModule();
     for (auto gi = M.global_begin(); gi != M.global_end(); ++gi) {
       if (auto *pointed = dyn_cast<GlobalVariable>(gi->getInitializer())) {
         mpt.insert(pointed);
@@ -306,7 +802,7 @@ struct LegacyConstPropPass: CallGraphSCCPass {
           }
         }
         // MPT case 3: function(...&operand(s)...) and return &operand MPT -> {operand(s)}
-        else if (auto *call = dyn_cast<CallInst>(&*I)) {
+        else if (auto *call = dyn_cast<CallBase>(&*I)) {
           auto func = call->getCalledFunction();
           for (Use& operand: call->operands()) {
             auto v = operand.get();
@@ -323,80 +819,210 @@ struct LegacyConstPropPass: CallGraphSCCPass {
         }
       }
     }
-    // calculating LMOD...
-    GlobalVars mptGlobal;
-    for (auto v: mpt) {
-      if (auto *gv = dyn_cast<GlobalVariable>(v)) {
-        mptGlobal.insert(gv);
-      }
-    }
+    return mpt;
+  }
+
+  /*
+   * MPT from the Andersen points-to sets: the objects a store through a
+   * loaded pointer may write, and the pointers stored to that may point to
+   * one of them.
+   */
+  Values computeAndersenMPT(Module &M) {
+    Values mpt;
+    AndersenAnalysis aa(M);
+    AndersenAnalysis::PointsTo targets;
+    std::vector<Value*> stored;
     for (auto &fi: M) {
-      mod[&fi] = {};
       for (auto I = inst_begin(fi), E = inst_end(fi); I != E; ++I) {
         if (auto *store = dyn_cast<StoreInst>(&*I)) {
           auto ptr = store->getPointerOperand();
-          // LMOD case 1: global_var = ____ => MOD[&F] -> {global_var}
-          if (auto *glob = dyn_cast<GlobalVariable>(ptr)) {
-            mod[&fi].insert(glob);
-          }
-          // LMOD case 2: *var = _____ => MOD[&F] -> {global_subset(MPT)}
-          else if (auto *load = dyn_cast<LoadInst>(ptr)) {
-            mod[&fi].insert(mptGlobal.begin(), mptGlobal.end());
+          if (isa<LoadInst>(ptr)) {
+            targets |= aa.getPointsTo(ptr);
           }
+          stored.push_back(ptr);
         }
       }
     }
-    return false;
+    for (unsigned o: targets) {
+      mpt.insert(aa.getObject(o));
+    }
+    for (auto ptr: stored) {
+      if (aa.getPointsTo(ptr).intersects(targets)) {
+        mpt.insert(ptr);
+      }
+    }
+    return mpt;
   }
 
-  // calcualte CMOD here
-  bool runOnSCC(CallGraphSCC &SCC) override {
-    GlobalVars same;
-    for (auto node: SCC) {
-      auto caller = node->getFunction();
-      if (caller == nullptr) {
-        // skip special "null" nodes which represent theoretical entries in the call graph.
+  // Number of each kind of rewrite made by rewriteFunction
+  struct RewriteCounts {
+    unsigned Loads = 0;
+    unsigned Folded = 0;
+    unsigned Branches = 0;
+    unsigned Blocks = 0;
+  };
+
+  /*
+   * Rewrite F with the results of the SCCP engine on it: loads of globals
+   * and arithmetic or compares known to be constant are replaced by the
+   * constant, branches and switches on a constant go to their only
+   * executable successor, and the blocks no longer reachable are deleted.
+   */
+  bool rewriteFunction(Function &F, const ConstPropAnalysis &cpa, RewriteCounts &counts) {
+    bool changed = false;
+    std::vector<Instruction*> dead;
+    for (auto &BB: F) {
+      if (!cpa.isExecutable(&BB)) {
         continue;
       }
+      for (auto &I: BB) {
+        auto *load = dyn_cast<LoadInst>(&I);
+        bool globalLoad = load && isa<GlobalVariable>(load->getPointerOperand());
+        if (!globalLoad && !isa<BinaryOperator>(I) && !isa<UnaryOperator>(I) && !isa<CmpInst>(I)) {
+          continue;
+        }
+        auto c = cpa.getSCCPConstant(&I);
+        if (!c || c->getType() != I.getType()) {
+          continue;
+        }
+        I.replaceAllUsesWith(c);
+        dead.push_back(&I);
+        if (globalLoad) {
+          counts.Loads++;
+        } else {
+          counts.Folded++;
+        }
+      }
+    }
+    for (auto I: dead) {
+      I->eraseFromParent();
+    }
+    changed |= !dead.empty();
 
-      GlobalVars cmod;
-      for (auto record = node->begin(); record != node->end(); ++record) {
-        auto calleeNode = record->second;
-        auto callee = calleeNode->getFunction();
-        cmod.insert(mod[callee].begin(), mod[callee].end());
+    for (auto &BB: F) {
+      if (!cpa.isExecutable(&BB)) {
+        continue;
       }
+      auto term = BB.getTerminator();
+      if (auto *br = dyn_cast<BranchInst>(term)) {
+        if (br->isConditional()) {
+          if (auto *ci = dyn_cast_or_null<ConstantInt>(cpa.getSCCPConstant(br->getCondition()))) {
+            br->setCondition(ci);
+          }
+        }
+      } else if (auto *sw = dyn_cast<SwitchInst>(term)) {
+        if (auto *ci = dyn_cast_or_null<ConstantInt>(cpa.getSCCPConstant(sw->getCondition()))) {
+          sw->setCondition(ci);
+        }
+      }
+      if (ConstantFoldTerminator(&BB, true)) {
+        counts.Branches++;
+        changed = true;
+      }
+    }
 
-      mod[caller].insert(cmod.begin(), cmod.end());
-      same.insert(mod[caller].begin(), mod[caller].end());
+    unsigned before = F.size();
+    if (removeUnreachableBlocks(F)) {
+      counts.Blocks += before - F.size();
+      changed = true;
     }
-    // loop
-    if (!SCC.isSingular()) {
-      for (auto node: SCC) {
-        mod[node->getFunction()] = same;
+    return changed;
+  }
+}
+
+// Constant propagation as a transform over the whole module
+struct NewConstPropPass: PassInfoMixin<NewConstPropPass> {
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+    Values mpt = AndersenMPT ? computeAndersenMPT(M) : computeMPT(M);
+    // calls to code outside the module may touch its visible globals
+    GlobalModRefInfo modref(M, mpt, true);
+    CallGraph CG(M);
+    modref.propagate(CG);
+
+    GlobalSlots slots(M);
+    ConstPropInfo bottom(&slots);
+    ConstPropInfo initState(&slots);
+    for (auto gv: slots.Globals) {
+      initState.setBottom(gv);
+    }
+    RewriteCounts counts;
+    bool changed = false;
+    for (auto &F: M) {
+      if (F.isDeclaration()) {
+        continue;
       }
+      auto cpa = new ConstPropAnalysis(bottom, initState, modref, mpt);
+      cpa->setTrackAliasedMemory(false);
+      cpa->runSCCPAlgorithm(&F);
+      changed |= rewriteFunction(F, *cpa, counts);
+      delete cpa;
     }
+    errs() << "Replaced " << counts.Loads << " loads, folded " << counts.Folded
+           << " instructions and " << counts.Branches << " branches, deleted "
+           << counts.Blocks << " blocks\n";
+    return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+  }
+};
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "Constant Propagation", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, ModulePassManager &MPM, ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "cse231-constprop-opt") {
+                  MPM.addPass(NewConstPropPass());
+                  return true;
+                }
+                return false;
+            });
+          }};
+}
+
+struct LegacyConstPropPass: CallGraphSCCPass {
+  static char ID;
+  LegacyConstPropPass(): CallGraphSCCPass(ID) {}
+
+  // calculate MPT and LMOD here
+  bool doInitialization(CallGraph &CG) override {
+    auto &M = CG.getModule();
+    mpt = AndersenMPT ? computeAndersenMPT(M) : computeMPT(M);
+
+    // calculating LMOD (and LREF) over dense global ids...
+    modref.reset(new GlobalModRefInfo(M, mpt));
+    return false;
+  }
+
+  // calcualte CMOD here, the SCCs come bottom-up
+  bool runOnSCC(CallGraphSCC &SCC) override {
+    std::vector<CallGraphNode*> nodes(SCC.begin(), SCC.end());
+    modref->propagate(nodes);
     return false;
   }
 
-  // do the Constant Prop Analysis here
+  // do the Constant Prop Analysis here, MOD and MPT are read-only from now on
   bool doFinalization(CallGraph &CG) override {
-    ConstPropInfo bottom{};
-    ConstPropInfo initState{};
-    for (auto &gv: CG.getModule().getGlobalList()) {
-      initState.setBottom(&gv);
-      bottom.setTop(&gv);
-    }
-    for (Function& F: CG.getModule().functions()) {
-      auto cpa = new ConstPropAnalysis(bottom, initState, mod, mpt);
-      cpa->runWorklistAlgorithm(&F);
-      cpa->print();
-      delete cpa;
+    GlobalSlots slots(CG.getModule());
+    ConstPropInfo bottom(&slots);
+    ConstPropInfo initState(&slots);
+    for (auto gv: slots.Globals) {
+      initState.setBottom(gv);
     }
+    runOnFunctions(CG.getModule(), Threads, [&](Function &F, raw_ostream &OS) {
+      auto cpa = new ConstPropAnalysis(bottom, initState, *modref, mpt);
+      if (Engine == ConstPropEngine::SCCP) {
+        cpa->runSCCPAlgorithm(&F);
+      } else {
+        cpa->runWorklistAlgorithm(&F);
+      }
+      cpa->print(OS);
+      delete cpa;
+    });
     return false;
   }
 private:
   Values  mpt;
-  FuncMap mod;
+  std::unique_ptr<GlobalModRefInfo> modref;
 };
 
 char LegacyConstPropPass::ID = 0;